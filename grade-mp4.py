@@ -325,7 +325,7 @@ def test_normal_write():
     pbn0_val = get_pbn0_for_file_lbn(r, TEST_FILE_LBN_IN_C)
     if pbn0_val is None:
         return
-    pbn1_val = pbn0_val + 2048
+    pbn1_val = pbn0_val + 4096
 
     r.run_qemu(shell_script(["echo .", "mp4_2_write_failure_test 0"]))
     r.match_substrings_ordered(
@@ -346,7 +346,7 @@ def test_disk0_failure():
     pbn0_val = get_pbn0_for_file_lbn(r, TEST_FILE_LBN_IN_C)
     if pbn0_val is None:
         return
-    pbn1_val = pbn0_val + 2048
+    pbn1_val = pbn0_val + 4096
 
     r.run_qemu(
         shell_script(["echo .", "mp4_2_write_failure_test 1"])
@@ -381,4 +381,20 @@ def test_fallback_verification():
     r.match_substrings_ordered("Bread Disk Failure Fallback Test: PASS")
 
 
+@test(10, "bigfile on an indirect block map image")
+def test_bigfile_indirect():
+    # the default image maps blocks by extents; make fs.img again
+    # with indirect blocks, and put the default one back after.
+    maybe_unlink("fs.img", "fs1.img")
+    try:
+        r.run_qemu(
+            shell_script(["echo .", "bigfile"]),
+            make_args=["FS_MAP=indirect"],
+            timeout=120,
+        )
+    finally:
+        maybe_unlink("fs.img", "fs1.img")
+    r.match_substrings_ordered("Big File Test: PASS")
+
+
 run_tests()
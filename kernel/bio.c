@@ -1,6 +1,6 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
@@ -12,47 +12,550 @@
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
+//
+// Locking:
+// * Each hash bucket has its own spin-lock, which protects the
+//   bucket's chain and the dev, blockno, refcnt and refbit fields
+//   of the buffers on it.  A cache hit takes only that lock.
+// * bcache.lock serializes misses.  It protects the replacement
+//   queues (qnext, qprev) and is the only lock under which a
+//   buffer may move from one bucket to another.
+// * bcache.ralock protects the count of read-ahead reads in
+//   flight, and is the lock bget() sleeps under while it waits
+//   for them. Nobody sleeps or wakes up holding bcache.lock:
+//   sleep() and wakeup() take proc locks, and kalloc() is called
+//   with one held.
+//
+// The cache starts out with NBUF buffers. A miss grows it by a slab
+// of buffers while memory allows, up to 1/BCACHE_FRAC of RAM, and
+// the breclaim thread shrinks it again when free pages run low.
+//
+// Replacement is chosen at build time (make BCACHE_POLICY=...):
+// * clock: a CLOCK hand sweeps a ring of all buffers, sparing
+//   those used since it last passed. One scan of a big file
+//   sweeps everything else out.
+// * 2q: a block read in once goes on the A1in FIFO, and joins Am,
+//   the main queue, only if it is missed on again while A1out,
+//   a ring of the blocks A1in gave up most recently, remembers it.
+//   A scan thus passes through A1in, and the inode, bitmap and
+//   directory blocks that are reused stay on Am, which is swept
+//   like CLOCK.
 
 #include "types.h"
 #include "param.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "riscv.h"
+#include "memlayout.h"
 #include "defs.h"
 #include "fs.h"
 #include "buf.h"
+#include "iostat.h"
+#include "blktrace.h"
 
 // Added: global variable added
 extern int force_read_error_pbn;
 extern int force_disk_fail_id;
 
+#define NBUCKET 1021 // prime, so block runs spread over the buckets
+
+// The cache grows and shrinks a slab at a time: a page of buffer
+// headers, and the data pages behind them, BPP blocks to a page.
+#define BPERSLAB 16
+#define BPP (PGSIZE / BSIZE)
+#define SLABPAGES (1 + BPERSLAB / BPP)
+#define MAXPAGES ((PHYSTOP - KERNBASE) / PGSIZE / BCACHE_FRAC)
+#define MAXBUF (MAXPAGES / SLABPAGES * BPERSLAB)
+#define SPARE 64 // free pages growing must leave to everyone else
+#define LOWATER (SPARE / 2) // free pages below which breclaim shrinks
+
+#ifdef BCACHE_2Q
+// A1out remembers as many blocks as half the buffers; KOUT is the
+// most that can be. A hash table finds them on each miss.
+#define KOUT (MAXBUF / 2)
+#define NOUTHASH 4093 // prime
+#endif
+
+// which list a buffer is on (b->q)
+#define Q_FREE 0 // holds no block
+#define Q_AM 1   // the CLOCK ring, or 2Q's Am
+#define Q_A1IN 2 // 2Q's A1in
+
+struct bucket
+{
+    struct spinlock lock;
+    struct buf head; // chain of buffers hashing here, through prev/next
+    uint64 hits;     // lookups that found their block on this chain
+    uint64 rahits;   // ... that found it there thanks to read-ahead
+};
+
+struct bslab
+{
+    struct bslab *next;
+    struct buf buf[BPERSLAB];
+};
+
 struct
 {
     struct spinlock lock;
-    struct buf buf[NBUF];
+    struct bucket bucket[NBUCKET];
+    struct bslab *slabs;
+    int nbuf;     // buffers in the slabs
+    int npages;   // pages the slabs take, or are about to
+    int maxpages; // and may take: MAXPAGES, or less (bsetmax())
 
-    // Linked list of all buffers, through prev/next.
-    // Sorted by how recently the buffer was used.
-    // head.next is most recent, head.prev is least.
-    struct buf head;
+    // Heads of the lists through qnext/qprev, oldest first. Every
+    // buffer holding a block is on am, or under 2Q on a1in.
+    struct buf free;
+    struct buf am;
+#ifdef BCACHE_2Q
+    struct buf a1in;
+    int na1in;
+    struct
+    {
+        uint dev; // 0 for an empty slot
+        uint blockno;
+        ushort next; // next slot on its hash chain, plus 1; 0 ends it
+    } a1out[KOUT];
+    ushort a1outhash[NOUTHASH]; // first slot on each chain, plus 1
+    int a1outnext;              // slot to fill next
+#endif
+    uint64 misses;
+    struct spinlock ralock;
+    int rainflight;  // read-ahead reads not yet finished
+    uint64 raissued; // read-ahead reads started
+    uint64 rawasted; // read-ahead buffers recycled before any use
+    uint64 grown;    // slabs added
+    uint64 shrunk;   // slabs given back to kalloc()
 } bcache;
 
-void binit(void)
+static struct bucket *bhash(uint dev, uint blockno)
+{
+    return &bcache.bucket[(dev * 31 + blockno) % NBUCKET];
+}
+
+// Find (dev, blockno) on bk's chain. Caller holds bk->lock.
+static struct buf *bfind(struct bucket *bk, uint dev, uint blockno)
 {
     struct buf *b;
 
-    initlock(&bcache.lock, "bcache");
+    for (b = bk->head.next; b != &bk->head; b = b->next)
+        if (b->dev == dev && b->blockno == blockno)
+            return b;
+    return 0;
+}
+
+// Put b at the front of bk's chain. Caller holds bk->lock.
+static void blink(struct bucket *bk, struct buf *b)
+{
+    b->next = bk->head.next;
+    b->prev = &bk->head;
+    bk->head.next->prev = b;
+    bk->head.next = b;
+}
+
+static void bunlink(struct buf *b)
+{
+    b->next->prev = b->prev;
+    b->prev->next = b->next;
+}
+
+// Put b at the back of list q. Caller holds bcache.lock.
+static void qappend(int q, struct buf *b)
+{
+    struct buf *h = &bcache.am;
+
+    if (q == Q_FREE)
+        h = &bcache.free;
+#ifdef BCACHE_2Q
+    if (q == Q_A1IN)
+    {
+        h = &bcache.a1in;
+        bcache.na1in++;
+    }
+#endif
+    b->q = q;
+    b->qprev = h->qprev;
+    b->qnext = h;
+    h->qprev->qnext = b;
+    h->qprev = b;
+}
+
+// Take b off its list. Caller holds bcache.lock.
+static void qremove(struct buf *b)
+{
+    b->qnext->qprev = b->qprev;
+    b->qprev->qnext = b->qnext;
+#ifdef BCACHE_2Q
+    if (b->q == Q_A1IN)
+        bcache.na1in--;
+#endif
+}
 
-    // Create linked list of buffers
-    bcache.head.prev = &bcache.head;
-    bcache.head.next = &bcache.head;
-    for (b = bcache.buf; b < bcache.buf + NBUF; b++)
+static void qinit(struct buf *h)
+{
+    h->qnext = h;
+    h->qprev = h;
+}
+
+// Add a slab of free buffers, unless the cache is as big as it may
+// get or memory is short. Returns 1 if it did. The caller must not
+// hold bcache.lock.
+static int bgrow(void)
+{
+    char *pg[SLABPAGES];
+    struct bslab *s;
+    struct buf *b;
+    int i, n;
+
+    acquire(&bcache.lock);
+    if (bcache.npages + SLABPAGES > bcache.maxpages ||
+        kfreepages() < SLABPAGES + SPARE)
+    {
+        release(&bcache.lock);
+        return 0;
+    }
+    bcache.npages += SLABPAGES;
+    release(&bcache.lock);
+
+    for (n = 0; n < SLABPAGES; n++)
+        if ((pg[n] = kalloc()) == 0)
+            break;
+    if (n < SLABPAGES)
     {
-        b->next = bcache.head.next;
-        b->prev = &bcache.head;
+        while (n > 0)
+            kfree(pg[--n]);
+        acquire(&bcache.lock);
+        bcache.npages -= SLABPAGES;
+        release(&bcache.lock);
+        return 0;
+    }
+
+    s = (struct bslab *)pg[0];
+    memset(s, 0, sizeof(*s));
+    acquire(&bcache.lock);
+    for (i = 0; i < BPERSLAB; i++)
+    {
+        b = &s->buf[i];
         initsleeplock(&b->lock, "buffer");
-        bcache.head.next->prev = b;
-        bcache.head.next = b;
+        b->data = (uchar *)pg[1 + i / BPP] + (i % BPP) * BSIZE;
+        qappend(Q_FREE, b);
+    }
+    s->next = bcache.slabs;
+    bcache.slabs = s;
+    bcache.nbuf += BPERSLAB;
+    bcache.grown++;
+    release(&bcache.lock);
+    return 1;
+}
+
+void binit(void)
+{
+    struct bucket *bk;
+
+    initlock(&bcache.lock, "bcache");
+    initlock(&bcache.ralock, "bcache.ra");
+    bcache.maxpages = MAXPAGES;
+    for (bk = bcache.bucket; bk < bcache.bucket + NBUCKET; bk++)
+    {
+        initlock(&bk->lock, "bcache.bucket");
+        bk->head.prev = &bk->head;
+        bk->head.next = &bk->head;
+    }
+    qinit(&bcache.free);
+    qinit(&bcache.am);
+#ifdef BCACHE_2Q
+    qinit(&bcache.a1in);
+#endif
+
+    if (sizeof(struct bslab) > PGSIZE)
+        panic("binit: slab");
+    while (bcache.nbuf < NBUF)
+        if (!bgrow())
+            panic("binit: no memory");
+}
+
+// Take b for recycling if nobody holds it and, if chance is set,
+// its reference bit is clear; clear the bit otherwise, so that b
+// goes next time. Returns 1 with b off its chain and refcnt 1.
+// Caller holds bcache.lock.
+static int btake(struct buf *b, int chance)
+{
+    struct bucket *bk;
+    int took = 0;
+
+    // b->dev and b->blockno only change under bcache.lock,
+    // so it is safe to hash them before taking the bucket lock.
+    bk = bhash(b->dev, b->blockno);
+    acquire(&bk->lock);
+    if (b->refcnt == 0)
+    {
+        if (!chance || b->refbit == 0)
+        {
+            bunlink(b);
+            b->refcnt = 1;
+            if (b->ra)
+                bcache.rawasted++;
+            b->ra = 0;
+            took = 1;
+        }
+        else
+            b->refbit = 0;
+    }
+    release(&bk->lock);
+    return took;
+}
+
+// Undo btake(b): b goes back on its chain, still holding its block.
+// Caller holds bcache.lock.
+static void buntake(struct buf *b)
+{
+    struct bucket *bk = bhash(b->dev, b->blockno);
+
+    acquire(&bk->lock);
+    blink(bk, b);
+    b->refcnt = 0;
+    release(&bk->lock);
+}
+
+// Give the pages of a slab back to kalloc(), if the cache is above
+// its minimum size and some slab has no buffer in use. The blocks
+// its buffers held are dropped. Returns 1 if it did.
+static int bshrink(void)
+{
+    struct bslab *s, **sp;
+    int i, n;
+
+    acquire(&bcache.lock);
+    if (bcache.nbuf - BPERSLAB < NBUF)
+    {
+        release(&bcache.lock);
+        return 0;
+    }
+
+    // take all of a slab's buffers, or none.
+    for (sp = &bcache.slabs; (s = *sp) != 0; sp = &s->next)
+    {
+        for (n = 0; n < BPERSLAB; n++)
+            if (s->buf[n].q != Q_FREE && !btake(&s->buf[n], 0))
+                break;
+        if (n == BPERSLAB)
+            break;
+        while (--n >= 0)
+            if (s->buf[n].q != Q_FREE)
+                buntake(&s->buf[n]);
+    }
+    if (s == 0)
+    {
+        release(&bcache.lock);
+        return 0;
+    }
+
+    for (i = 0; i < BPERSLAB; i++)
+        qremove(&s->buf[i]);
+    *sp = s->next;
+    bcache.nbuf -= BPERSLAB;
+    bcache.npages -= SLABPAGES;
+    bcache.shrunk++;
+    release(&bcache.lock);
+
+    for (i = 0; i < BPERSLAB; i += BPP)
+        kfree(s->buf[i].data);
+    kfree(s);
+    return 1;
+}
+
+// Give slabs back whenever free pages run low, checking each tick.
+// kalloc() cannot do it itself: its callers may hold a proc lock.
+static void breclaim(void *arg)
+{
+    for (;;)
+    {
+        while (kfreepages() < LOWATER && bshrink())
+            ;
+        acquire(&tickslock);
+        sleep(&ticks, &tickslock);
+        release(&tickslock);
+    }
+}
+
+// Let the cache grow to n buffers at most, rounded up to whole
+// slabs and kept between NBUF and MAXBUF, and shrink it to that if
+// its buffers are not in use. Returns the previous limit.
+int bsetmax(int n)
+{
+    int old;
+
+    if (n < NBUF)
+        n = NBUF;
+    if (n > MAXBUF)
+        n = MAXBUF;
+    acquire(&bcache.lock);
+    old = bcache.maxpages / SLABPAGES * BPERSLAB;
+    bcache.maxpages = (n + BPERSLAB - 1) / BPERSLAB * SLABPAGES;
+    release(&bcache.lock);
+
+    // racy, but bshrink() itself never goes below NBUF.
+    while (bcache.npages > bcache.maxpages && bshrink())
+        ;
+    return old;
+}
+
+// Start the breclaim thread. Called by the first process, once
+// processes can be made.
+void breclaiminit(void)
+{
+    if (kthread_create(breclaim, 0, "breclaim") < 0)
+        panic("breclaiminit");
+}
+
+// Sweep Am, or the CLOCK ring, like a CLOCK hand: take the buffer
+// at the front if nobody holds it and its reference bit is clear,
+// else clear the bit and move it to the back. Every unused buffer
+// is found within two turns. Caller holds bcache.lock.
+static struct buf *bsweep(void)
+{
+    struct buf *b;
+    int i;
+
+    for (i = 0; i < 2 * bcache.nbuf && bcache.am.qnext != &bcache.am; i++)
+    {
+        b = bcache.am.qnext;
+        qremove(b);
+        if (btake(b, 1))
+            return b;
+        qappend(Q_AM, b);
+    }
+    return 0;
+}
+
+#ifdef BCACHE_2Q
+static ushort *a1out_chain(uint dev, uint blockno)
+{
+    return &bcache.a1outhash[(dev * 31 + blockno) % NOUTHASH];
+}
+
+// The A1out slot remembering (dev, blockno), or -1.
+// Caller holds bcache.lock, as for all of A1out.
+static int a1out_find(uint dev, uint blockno)
+{
+    int i;
+
+    for (i = *a1out_chain(dev, blockno) - 1; i >= 0;
+         i = bcache.a1out[i].next - 1)
+        if (bcache.a1out[i].dev == dev && bcache.a1out[i].blockno == blockno)
+            return i;
+    return -1;
+}
+
+// Empty slot i, which remembers a block.
+static void a1out_forget(int i)
+{
+    ushort *p = a1out_chain(bcache.a1out[i].dev, bcache.a1out[i].blockno);
+
+    while (*p != i + 1)
+        p = &bcache.a1out[*p - 1].next;
+    *p = bcache.a1out[i].next;
+    bcache.a1out[i].dev = 0;
+}
+
+// Remember b's block in the next slot of the ring, forgetting the
+// oldest. The ring is half as long as the cache is big; a slot left
+// past its end when the cache shrank stays findable until reused.
+static void a1out_remember(struct buf *b)
+{
+    ushort *p = a1out_chain(b->dev, b->blockno);
+    int i;
+
+    if (bcache.a1outnext >= bcache.nbuf / 2) // the cache shrank
+        bcache.a1outnext = 0;
+    i = bcache.a1outnext;
+    if (bcache.a1out[i].dev != 0)
+        a1out_forget(i);
+    bcache.a1out[i].dev = b->dev;
+    bcache.a1out[i].blockno = b->blockno;
+    bcache.a1out[i].next = *p;
+    *p = i + 1;
+    bcache.a1outnext = (i + 1) % (bcache.nbuf / 2);
+}
+
+// Give up the oldest buffer on A1in that nobody holds, and have
+// A1out remember its block. Returns it as btake() does, or 0.
+static struct buf *a1in_take(void)
+{
+    struct buf *b;
+
+    for (b = bcache.a1in.qnext; b != &bcache.a1in; b = b->qnext)
+    {
+        if (!btake(b, 0))
+            continue;
+        qremove(b);
+        if (b->valid)
+            a1out_remember(b);
+        return b;
+    }
+    return 0;
+}
+
+// Choose a buffer to recycle: A1in's oldest while A1in holds over
+// a quarter of the buffers, else one swept from Am, else whatever
+// A1in has left.
+static struct buf *breplace(void)
+{
+    struct buf *b;
+
+    if (bcache.na1in > bcache.nbuf / 4 && (b = a1in_take()) != 0)
+        return b;
+    if ((b = bsweep()) != 0)
+        return b;
+    return a1in_take();
+}
+
+// Queue b, which now holds a new block: on Am if A1out remembers
+// the block, else on A1in. Caller holds bcache.lock.
+static void bqueue(struct buf *b)
+{
+    int i;
+
+    if ((i = a1out_find(b->dev, b->blockno)) >= 0)
+    {
+        a1out_forget(i);
+        qappend(Q_AM, b);
+        return;
+    }
+    qappend(Q_A1IN, b);
+}
+#else
+static struct buf *breplace(void) { return bsweep(); }
+
+// Queue b, which now holds a new block. Caller holds bcache.lock.
+static void bqueue(struct buf *b) { qappend(Q_AM, b); }
+#endif
+
+// A buffer for a new block: a free one, or one the replacement
+// policy recycles. Returns it off any chain and list, with refcnt
+// 1, or 0 if every buffer is in use. Caller holds bcache.lock.
+static struct buf *bvictim(void)
+{
+    struct buf *b = bcache.free.qnext;
+
+    if (b == &bcache.free)
+        return breplace();
+    qremove(b);
+    b->refcnt = 1;
+    return b;
+}
+
+// Count a hit on b, crediting read-ahead if it brought b in.
+// Caller holds b's bucket lock.
+static void bhit(struct bucket *bk, struct buf *b)
+{
+    b->refcnt++;
+    bk->hits++;
+    if (b->ra)
+    {
+        bk->rahits++;
+        b->ra = 0;
     }
 }
 
@@ -61,160 +564,450 @@ void binit(void)
 // In either case, return locked buffer.
 struct buf *bget(uint dev, uint blockno)
 {
+    struct bucket *bk = bhash(dev, blockno);
     struct buf *b;
-    acquire(&bcache.lock);
+    int grew;
 
     // Is the block already cached?
-    for (b = bcache.head.next; b != &bcache.head; b = b->next)
+    acquire(&bk->lock);
+    if ((b = bfind(bk, dev, blockno)) != 0)
     {
-        if (b->dev == dev && b->blockno == blockno)
-        {
-            b->refcnt++;
-            release(&bcache.lock);
-            acquiresleep(&b->lock);
-            return b;
-        }
+        bhit(bk, b);
+        release(&bk->lock);
+        acquiresleep(&b->lock);
+        return b;
     }
+    release(&bk->lock);
 
-    // Not cached.
-    // Recycle the least recently used (LRU) unused buffer.
-    for (b = bcache.head.prev; b != &bcache.head; b = b->prev)
+    // Not cached. Rather than recycle a buffer, grow the cache if
+    // it may. (The peek at the free list is racy; at worst the cache
+    // grows a little early, or recycles once.)
+    if (bcache.free.qnext == &bcache.free)
+        bgrow();
+
+    // Another process may be installing the same block, so look
+    // again once we hold bcache.lock, which every install happens
+    // under.
+    acquire(&bcache.lock);
+    for (;;)
     {
-        if (b->refcnt == 0)
+        acquire(&bk->lock);
+        if ((b = bfind(bk, dev, blockno)) != 0)
         {
-            b->dev = dev;
-            b->blockno = blockno;
-            b->valid = 0;
-            b->refcnt = 1;
+            bhit(bk, b);
+            release(&bk->lock);
             release(&bcache.lock);
             acquiresleep(&b->lock);
             return b;
         }
+        release(&bk->lock);
+
+        // Take a free buffer or recycle one. If every one is in
+        // use, grow after all: pages may have been freed since the
+        // check above.
+        if ((b = bvictim()) != 0)
+            break;
+        release(&bcache.lock);
+        grew = bgrow();
+        acquire(&bcache.lock);
+        if (grew)
+            continue;
+
+        // If read-ahead holds the ones left, wait for it to give
+        // them back. A read that finishes gives its buffer back
+        // before it takes ralock to count itself done, so with
+        // ralock held either bvictim() finds the buffer or the
+        // read is still counted, and will wake us.
+        acquire(&bcache.ralock);
+        if ((b = bvictim()) != 0)
+        {
+            release(&bcache.ralock);
+            break;
+        }
+        if (bcache.rainflight == 0)
+            panic("bget: no buffers");
+        release(&bcache.lock);
+        sleep(&bcache.rainflight, &bcache.ralock);
+        release(&bcache.ralock);
+        acquire(&bcache.lock);
     }
-    panic("bget: no buffers");
+    b->dev = dev;
+    b->blockno = blockno;
+    b->valid = 0;
+    b->leg = -1;
+    b->refbit = 0;
+    bqueue(b);
+    bcache.misses++;
+
+    acquire(&bk->lock);
+    blink(bk, b);
+    release(&bk->lock);
+    release(&bcache.lock);
+
+    acquiresleep(&b->lock);
+    return b;
 }
 
-// TODO: RAID 1 simulation
-// Return a locked buf with the contents of the indicated block.
-struct buf *bread(uint dev, uint blockno)
+// Finish a read started by bprefetch(): the buffer becomes valid,
+// and is released to whoever is waiting for it, or to the cache.
+// A copy that fails its checksum is left invalid instead, for
+// bread() to read again and repair, which it cannot do here.
+// Called from the disk interrupt, so not from b's lock holder.
+static void bprefetch_done(struct bioreq *r)
+{
+    struct buf *b = r->bp[0];
+    struct bucket *bk;
+
+    mirror_read_done(b->leg);
+    b->valid = mirror_csumok(b);
+    releasesleep(&b->lock);
+
+    bk = bhash(b->dev, b->blockno);
+    acquire(&bk->lock);
+    b->refcnt--;
+    if (b->refcnt == 0)
+        b->refbit = 1;
+    release(&bk->lock);
+
+    acquire(&bcache.ralock);
+    bcache.rainflight--;
+    wakeup(&bcache.rainflight);
+    release(&bcache.ralock);
+}
+
+// Drop the cached copy of a block, if nobody holds or has pinned
+// it, so that the next bread() goes to the disk. For the raw disk
+// system calls, which change blocks behind the cache's back.
+void bforget(uint dev, uint blockno)
 {
-    struct buf *b = bget(dev, blockno);
-    int pbn0 = blockno;
-    int pbn1 = pbn0 + DISK1_START_BLOCK;
-    int use_fallback = 0;
+    struct bucket *bk = bhash(dev, blockno);
+    struct buf *b;
 
-    if ((force_disk_fail_id == 0) || (force_read_error_pbn == pbn0))
+    acquire(&bcache.lock);
+    acquire(&bk->lock);
+    b = bfind(bk, dev, blockno);
+    release(&bk->lock);
+    if (b != 0 && btake(b, 0))
     {
-        use_fallback = 1;
+        qremove(b);
+        b->refcnt = 0;
+        b->valid = 0;
+        qappend(Q_FREE, b);
     }
+    release(&bcache.lock);
+}
 
-    if (!b->valid || use_fallback)
+// Start reading the indicated block into the cache, and return
+// without waiting for it. Read-ahead is only a hint: do nothing
+// if the block is already cached or if no buffer or no disk
+// descriptors are free right now.
+void bprefetch(uint dev, uint blockno)
+{
+    struct bucket *bk = bhash(dev, blockno);
+    struct buf *b;
+
+    acquire(&bcache.lock);
+    acquire(&bk->lock);
+    b = bfind(bk, dev, blockno);
+    release(&bk->lock);
+    if (b != 0 || (b = bvictim()) == 0)
     {
-        int original_blockno = b->blockno;
-        if (use_fallback)
-        {
-            b->blockno = pbn1;
-        }
-        else
-        {
-            b->blockno = pbn0;
-        }
-        virtio_disk_rw(b, 0);
-        b->valid = 1;
-        b->blockno = original_blockno;
+        release(&bcache.lock);
+        return;
     }
+    b->dev = dev;
+    b->blockno = blockno;
+    b->valid = 0;
+    b->refbit = 0;
+    b->ra = 1;
+    bqueue(b);
 
-    return b;
+    acquire(&bk->lock);
+    blink(bk, b);
+    release(&bk->lock);
+    release(&bcache.lock);
+
+    // Someone may have found b and read it before we got the lock.
+    acquiresleep(&b->lock);
+    if (b->valid)
+    {
+        brelse(b);
+        return;
+    }
+
+    acquire(&bcache.ralock);
+    bcache.rainflight++;
+    release(&bcache.ralock);
+
+    b->leg = mirror_read_leg(blockno);
+    b->req.bp[0] = b;
+    b->req.n = 1;
+    b->req.disk[0] = b->leg;
+    b->req.blockno[0] = blockno;
+    b->req.nleg = 1;
+    b->req.write = 0;
+    b->req.done = bprefetch_done;
+    if (virtio_disk_submit(&b->req, 1) < 0)
+    {
+        mirror_read_done(b->leg);
+        acquire(&bcache.ralock);
+        bcache.rainflight--;
+        wakeup(&bcache.rainflight);
+        release(&bcache.ralock);
+        acquire(&bk->lock);
+        b->ra = 0;
+        release(&bk->lock);
+        brelse(b);
+        return;
+    }
+    acquire(&bcache.lock);
+    bcache.raissued++;
+    release(&bcache.lock);
 }
 
-// TODO: RAID 1 simulation
-// Write b's contents to disk.  Must be locked.
-void bwrite(struct buf *b)
+// Read bp[0..n-1], which hold consecutive blocks, from one leg in
+// one disk request, and check each against its checksum; or only
+// as many of them as that leg holds up to date copies of, at least
+// one. Returns how many it read. Only misses come here, so a
+// simulated failure costs the cache nothing: blocks already cached
+// stay valid whichever leg they came from.
+static int bfill(struct buf **bp, int n)
 {
-    if (!holdingsleep(&b->lock))
-        panic("bwrite");
+    int i, leg = mirror_read_leg(bp[0]->blockno);
 
-    int pbn0 = b->blockno;
-    int pbn1 = pbn0 + DISK1_START_BLOCK;
-    int pbn0_fail = (force_read_error_pbn == pbn0);
-    int fail_disk = force_disk_fail_id;
+    for (i = 1; i < n; i++)
+        if (!mirror_canread(leg, bp[i]->blockno))
+            break;
+    n = i;
+    virtio_disk_rwn(bp, n, &leg, &bp[0]->blockno, 1, 0);
+    mirror_read_done(leg);
+    for (i = 0; i < n; i++)
+    {
+        bp[i]->leg = mirror_check(bp[i], leg);
+        bp[i]->valid = 1;
+    }
+    return n;
+}
+
+// Return locked bufs bp[0..n-1] with the contents of blocks
+// blockno .. blockno+n-1. Each run of them that must come from
+// disk is read with one request. A block with a simulated
+// failure is read on its own, since its leg may differ, and a run
+// ends early at a block stale on the leg chosen for its start.
+// n is at most NBATCH.
+void breadn(uint dev, uint blockno, int n, struct buf **bp)
+{
+    int i, j;
+
+    if (n < 1 || n > NBATCH)
+        panic("breadn");
+
+    for (i = 0; i < n; i++)
+        bp[i] = bget(dev, blockno + i);
+
+    for (i = 0; i < n; i = j)
+    {
+        j = i + 1;
+        if (bp[i]->valid)
+            continue;
+        while (j < n && !bp[j]->valid &&
+               force_read_error_pbn != bp[j]->blockno)
+            j++;
+        j = i + bfill(&bp[i], j - i);
+    }
+}
+
+// TODO: RAID 1 simulation
+// Return a locked buf with the contents of the indicated block.
+struct buf *bread(uint dev, uint blockno)
+{
+    struct buf *b;
 
-    printf(
-        "BW_DIAG: PBN0=%d, PBN1=%d, sim_disk_fail=%d, sim_pbn0_block_fail=%d\n",
-        pbn0, pbn1, fail_disk, pbn0_fail);
+    breadn(dev, blockno, 1, &b);
+    return b;
+}
 
-    int original_blockno = b->blockno;
+// TODO: RAID 1 simulation
+// Start writing the contents of bp[0..n-1], which must be locked, to
+// blocks blockno..blockno+n-1 of both RAID-1 legs, whatever blocks
+// the buffers cache: one disk request per leg, in flight at once.
+// The caller's r tracks the write; wait for it with bwait() before
+// releasing the buffers. n is at most NBATCH. Lets the log write a
+// cached block to its log slot, or a log slot to its home, without
+// copying it into the target's buffer.
+void bwritestart_at(struct bioreq *r, struct buf **bp, int n, uint blockno)
+{
+    int fail_disk = force_disk_fail_id;
+    int pbn0, pbn1, pbn0_fail = 0;
+    struct bioreq r1, *rp = &r1;
+    int i;
 
-    if (fail_disk == 0)
+    if (n < 1 || n > NBATCH)
+        panic("bwriten");
+    memset(r, 0, sizeof(*r));
+    for (i = 0; i < n; i++)
     {
-        printf(
-            "BW_ACTION: SKIP_PBN0 (PBN %d) due to simulated Disk 0 failure.\n",
-            pbn0);
+        if (!holdingsleep(&bp[i]->lock))
+            panic("bwrite");
+        if (force_read_error_pbn == blockno + i)
+            pbn0_fail = 1;
+        r->bp[i] = bp[i];
+        mirror_setcsum(bp[i], blockno + i);
     }
-    else if (pbn0_fail)
+    r->n = n;
+    r->write = 1;
+
+    // leg 0 skips a failing block, which splits its run: write the
+    // blocks one at a time, and leave r with nothing to wait for.
+    if (n > 1 && pbn0_fail)
     {
-        printf("BW_ACTION: SKIP_PBN0 (PBN %d) due to simulated PBN0 block "
-               "failure.\n",
-               pbn0);
+        for (i = 0; i < n; i++)
+        {
+            bwritestart_at(&r1, &bp[i], 1, blockno + i);
+            bwait(&rp, 1);
+        }
+        return;
     }
-    else
+
+    for (i = 0; i < n; i++)
     {
-        printf("BW_ACTION: ATTEMPT_PBN0 (PBN %d).\n", pbn0);
-        b->blockno = pbn0;
-        virtio_disk_rw(b, 1);
+        pbn0 = blockno + i;
+        pbn1 = mirror_pbn(1, pbn0);
+        blktrace_log(BT_BWRITE, pbn0, pbn1, fail_disk, pbn0_fail);
+
+        if (fail_disk == 0)
+            blktrace_log(BT_SKIP, pbn0, 0, BT_WHY_DISKFAIL, 0);
+        else if (pbn0_fail)
+            blktrace_log(BT_SKIP, pbn0, 0, BT_WHY_BLOCKFAIL, 0);
+        else
+            blktrace_log(BT_WRITE, pbn0, 0, 0, 0);
+
+        if (fail_disk == 1)
+            blktrace_log(BT_SKIP, pbn1, 1, BT_WHY_DISKFAIL, 0);
+        else
+            blktrace_log(BT_WRITE, pbn1, 1, 0, 0);
+
+        // the leg written alone must be known as the good copy
+        // before the write happens.
+        if (fail_disk == 1 && !pbn0_fail)
+            mirror_mark(1, pbn0);
+        else if (fail_disk == 0 || pbn0_fail)
+            mirror_mark(0, pbn0);
     }
 
-    if (fail_disk == 1)
+    if (fail_disk != 0 && !pbn0_fail)
     {
-        printf(
-            "BW_ACTION: SKIP_PBN1 (PBN %d) due to simulated Disk 1 failure.\n",
-            pbn1);
+        r->disk[r->nleg] = 0;
+        r->blockno[r->nleg++] = blockno;
     }
-    else
+    if (fail_disk != 1)
     {
-        printf("BW_ACTION: ATTEMPT_PBN1 (PBN %d).\n", pbn1);
-        b->blockno = pbn1;
-        virtio_disk_rw(b, 1);
+        r->disk[r->nleg] = 1;
+        r->blockno[r->nleg++] = blockno;
     }
+    if (r->nleg > 0)
+        virtio_disk_submit(r, 0);
+}
 
-    b->blockno = original_blockno;
+// Start writing the contents of bp[0..n-1], which must be locked
+// and hold consecutive blocks, to their blocks, as bwritestart_at()
+// does.
+void bwritestart(struct bioreq *r, struct buf **bp, int n)
+{
+    int i;
+
+    for (i = 1; i < n; i++)
+        if (bp[i]->dev != bp[0]->dev || bp[i]->blockno != bp[0]->blockno + i)
+            panic("bwriten: not consecutive");
+    bwritestart_at(r, bp, n, bp[0]->blockno);
+}
+
+// Wait for the n writes rs[0..n-1] started by bwritestart().
+void bwait(struct bioreq **rs, int n) { virtio_disk_wait(rs, n); }
+
+// Wait until the writes that have finished are on stable storage,
+// not just in the disks' write caches: the barrier between writes
+// that must reach the disk in order. Flushes both RAID-1 legs at
+// once, skipping a failed one.
+void bflush(void)
+{
+    int dsk[2], n = 0;
+
+    if (force_disk_fail_id != 0)
+        dsk[n++] = 0;
+    if (force_disk_fail_id != 1)
+        dsk[n++] = 1;
+    virtio_disk_flush(dsk, n);
+}
+
+// Write the contents of bp[0..n-1] as bwritestart() does, and wait.
+void bwriten(struct buf **bp, int n)
+{
+    struct bioreq r, *rp = &r;
+
+    bwritestart(&r, bp, n);
+    bwait(&rp, 1);
+}
+
+// Write b's contents to disk.  Must be locked.
+void bwrite(struct buf *b)
+{
+    bwriten(&b, 1);
 }
 
 // Release a locked buffer.
-// Move to the head of the most-recently-used list.
+// Set its reference bit so the CLOCK hand passes it over once.
 void brelse(struct buf *b)
 {
+    struct bucket *bk;
+
     if (!holdingsleep(&b->lock))
         panic("brelse");
 
     releasesleep(&b->lock);
 
-    acquire(&bcache.lock);
+    bk = bhash(b->dev, b->blockno);
+    acquire(&bk->lock);
     b->refcnt--;
     if (b->refcnt == 0)
-    {
-        // no one is waiting for it.
-        b->next->prev = b->prev;
-        b->prev->next = b->next;
-        b->next = bcache.head.next;
-        b->prev = &bcache.head;
-        bcache.head.next->prev = b;
-        bcache.head.next = b;
-    }
-
-    release(&bcache.lock);
+        b->refbit = 1;
+    release(&bk->lock);
 }
 
 void bpin(struct buf *b)
 {
-    acquire(&bcache.lock);
+    struct bucket *bk = bhash(b->dev, b->blockno);
+
+    acquire(&bk->lock);
     b->refcnt++;
-    release(&bcache.lock);
+    release(&bk->lock);
 }
 
 void bunpin(struct buf *b)
 {
-    acquire(&bcache.lock);
+    struct bucket *bk = bhash(b->dev, b->blockno);
+
+    acquire(&bk->lock);
     b->refcnt--;
-    release(&bcache.lock);
+    if (b->refcnt == 0)
+        b->refbit = 1;
+    release(&bk->lock);
+}
+
+// Add the buffer cache counters to *st.
+void bstat(struct iostat *st)
+{
+    struct bucket *bk;
+
+    for (bk = bcache.bucket; bk < bcache.bucket + NBUCKET; bk++)
+    {
+        st->bhits += bk->hits;
+        st->rahits += bk->rahits;
+    }
+    st->bmisses += bcache.misses;
+    st->raissued += bcache.raissued;
+    st->rawasted += bcache.rawasted;
+    st->bbufs += bcache.nbuf;
+    st->bgrown += bcache.grown;
+    st->bshrunk += bcache.shrunk;
 }
@@ -0,0 +1,120 @@
+// Block layer tracing.
+//
+// The mirror code logs its decisions with blktrace_log() instead of
+// printing them, since console output goes byte by byte to the UART
+// and would dominate the cost of every block write.
+//
+// Each CPU logs into its own ring, with interrupts off, so logging
+// takes no lock: the CPU is the only writer of its ring's head, and
+// blktrace_drain() is the only writer of the tail. A full ring drops
+// new events and counts them, rather than overwriting ones a drain
+// may be copying. Drains are serialized by tr.lock and merge the
+// rings by timestamp.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "proc.h"
+#include "defs.h"
+#include "blktrace.h"
+#include "iostat.h"
+
+#define NTRACE 256 // events per CPU; a power of two
+
+struct tracering
+{
+    uint head; // next slot to log into
+    uint tail; // next slot to drain
+    uint64 lost;
+    struct blkevent ev[NTRACE];
+};
+
+struct
+{
+    struct spinlock lock; // serializes drains
+    struct tracering ring[NCPU];
+} tr;
+
+void blktraceinit(void) { initlock(&tr.lock, "blktrace"); }
+
+// Log an event of type about physical block pbn.
+void blktrace_log(int type, int pbn, int a0, int a1, int a2)
+{
+    struct tracering *r;
+    struct blkevent *e;
+
+    push_off();
+    r = &tr.ring[cpuid()];
+    if (r->head - r->tail >= NTRACE)
+    {
+        r->lost++;
+        pop_off();
+        return;
+    }
+    e = &r->ev[r->head % NTRACE];
+    e->time = *(uint64 *)CLINT_MTIME;
+    e->type = type;
+    e->cpu = cpuid();
+    e->pbn = pbn;
+    e->arg[0] = a0;
+    e->arg[1] = a1;
+    e->arg[2] = a2;
+
+    // publish the event only once it is complete.
+    __sync_synchronize();
+    r->head++;
+    pop_off();
+}
+
+// Copy up to n of the oldest events, in time order, to user address
+// dst and remove them from the rings. If dst is 0, discard them.
+// Returns the number of events, or -1.
+int blktrace_drain(uint64 dst, int n)
+{
+    struct tracering *r, *oldest;
+    uint head[NCPU];
+    int i, got = 0;
+
+    acquire(&tr.lock);
+    for (i = 0; i < NCPU; i++)
+        head[i] = tr.ring[i].head;
+    __sync_synchronize();
+
+    while (got < n)
+    {
+        oldest = 0;
+        for (i = 0; i < NCPU; i++)
+        {
+            r = &tr.ring[i];
+            if (r->tail != head[i] &&
+                (oldest == 0 || r->ev[r->tail % NTRACE].time <
+                                    oldest->ev[oldest->tail % NTRACE].time))
+                oldest = r;
+        }
+        if (oldest == 0)
+            break;
+        if (dst != 0 &&
+            copyout(myproc()->pagetable, dst + got * sizeof(struct blkevent),
+                    (char *)&oldest->ev[oldest->tail % NTRACE],
+                    sizeof(struct blkevent)) < 0)
+        {
+            release(&tr.lock);
+            return -1;
+        }
+        // the slot may be reused once tail moves past it.
+        __sync_synchronize();
+        oldest->tail++;
+        got++;
+    }
+    release(&tr.lock);
+    return got;
+}
+
+// Add the trace counters to *st.
+void blktrace_stat(struct iostat *st)
+{
+    for (int i = 0; i < NCPU; i++)
+        st->tlost += tr.ring[i].lost;
+}
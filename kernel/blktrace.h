@@ -0,0 +1,28 @@
+// Block layer trace events, drained by the blktrace() system call.
+// Both the kernel and user programs use this header file.
+
+// event types, and what pbn and arg[] hold for each
+#define BT_BWRITE 1 // bwrite() called: pbn=PBN0, arg={PBN1, failed disk,
+                    //   PBN0 block failing}
+#define BT_SKIP 2   // a mirror leg not written: pbn, arg={leg, BT_WHY_*}
+#define BT_WRITE 3  // a mirror leg written: pbn, arg={leg}
+#define BT_READ 4   // a mirror leg read on a cache miss: pbn,
+                    //   arg={leg, BT_WHY_*, read policy}
+#define BT_RESYNC 5 // a stale block copied back to its leg: pbn,
+                    //   arg={leg}
+
+// why a leg was skipped, or chosen for a read
+#define BT_WHY_POLICY 0    // read policy's choice
+#define BT_WHY_DISKFAIL 1  // simulated failure of the other disk
+#define BT_WHY_BLOCKFAIL 2 // simulated failure of the PBN0 block
+#define BT_WHY_STALE 3     // the other leg missed a write of the block
+#define BT_WHY_CSUM 4      // the other leg's copy failed its checksum
+
+struct blkevent
+{
+    uint64 time; // CLINT mtime when logged
+    uint16 type; // BT_*
+    uint16 cpu;
+    int pbn;
+    int arg[3];
+};
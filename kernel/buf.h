@@ -1,3 +1,20 @@
+struct buf;
+
+// An asynchronous disk request, built by its submitter and owned
+// by the disk driver from virtio_disk_submit() until it finishes.
+struct bioreq
+{
+    struct buf *bp[NBATCH]; // buffers holding consecutive blocks
+    int n;                  // number of buffers in bp[]
+    int disk[2];            // the disk each run of blocks is on,
+    uint blockno[2];        // and where on it the run starts
+    int nleg;               // number of runs: one per RAID-1 leg
+    int write;
+    int flush;              // flush the disks' write caches; n is 0
+    void (*done)(struct bioreq *); // if set, called from the interrupt
+    int pending;                   // runs the device has not finished
+};
+
 struct buf
 {
     int valid; // has data been read from disk?
@@ -6,7 +23,14 @@ struct buf
     uint blockno;
     struct sleeplock lock;
     uint refcnt;
-    struct buf *prev; // LRU cache list
+    uint refbit;       // used since the CLOCK hand last passed?
+    struct buf *prev;  // hash bucket chain
     struct buf *next;
-    uchar data[BSIZE];
+    struct buf *qnext; // replacement or free list
+    struct buf *qprev;
+    int q;             // which list
+    int leg;           // RAID-1 leg the data was read from, or -1
+    int ra;            // read ahead, and not yet asked for?
+    struct bioreq req; // for I/O no process waits for
+    uchar *data;       // BSIZE bytes, in a page shared with 3 others
 };
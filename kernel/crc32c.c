@@ -0,0 +1,50 @@
+// CRC-32C (Castagnoli), the checksum of disk blocks.
+//
+// Table driven, four bytes per step ("slicing by 4"): table[k][i]
+// is the CRC of byte i followed by k zero bytes, so one 32-bit load
+// and four lookups advance the CRC by a word. Built by crc32cinit().
+// Also compiled into mkfs, so it needs nothing but types.h.
+
+#include "types.h"
+
+#define POLY 0x82f63b78 // reversed Castagnoli polynomial
+
+static uint table[4][256];
+
+void crc32cinit(void)
+{
+    uint i, k, c;
+
+    for (i = 0; i < 256; i++)
+    {
+        c = i;
+        for (k = 0; k < 8; k++)
+            c = (c >> 1) ^ ((c & 1) ? POLY : 0);
+        table[0][i] = c;
+    }
+    for (i = 0; i < 256; i++)
+        for (k = 1; k < 4; k++)
+            table[k][i] = (table[k - 1][i] >> 8) ^
+                          table[0][table[k - 1][i] & 0xff];
+}
+
+// Extend crc, the CRC of some earlier bytes (0 for none), over the
+// n bytes at p.
+uint crc32c(uint crc, const void *p, int n)
+{
+    const uchar *s = p;
+    uint w;
+
+    crc = ~crc;
+    for (; n > 0 && ((uint64)s & 3) != 0; n--)
+        crc = table[0][(crc ^ *s++) & 0xff] ^ (crc >> 8);
+    for (; n >= 4; n -= 4, s += 4)
+    {
+        w = crc ^ *(const uint *)s; // little-endian, like RISC-V
+        crc = table[3][w & 0xff] ^ table[2][(w >> 8) & 0xff] ^
+              table[1][(w >> 16) & 0xff] ^ table[0][w >> 24];
+    }
+    for (; n > 0; n--)
+        crc = table[0][(crc ^ *s++) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
@@ -1,28 +1,52 @@
 struct buf;
+struct bioreq;
 struct context;
 struct file;
 struct inode;
+struct iostat;
 struct pipe;
 struct proc;
 struct spinlock;
+struct superblock;
 struct sleeplock;
 struct stat;
 struct superblock;
 
 // bio.c
 void binit(void);
+void breclaiminit(void);
+int bsetmax(int);
 struct buf *bread(uint, uint);
+void breadn(uint, uint, int, struct buf **);
 void brelse(struct buf *);
 void bwrite(struct buf *);
+void bwriten(struct buf **, int);
+void bwritestart(struct bioreq *, struct buf **, int);
+void bwritestart_at(struct bioreq *, struct buf **, int, uint);
+void bwait(struct bioreq **, int);
+void bflush(void);
 void bpin(struct buf *);
 void bunpin(struct buf *);
 struct buf *bget(uint, uint);
+void bstat(struct iostat *);
+void bforget(uint, uint);
+void bprefetch(uint, uint);
+
+// blktrace.c
+void blktraceinit(void);
+void blktrace_log(int, int, int, int, int);
+int blktrace_drain(uint64, int);
+void blktrace_stat(struct iostat *);
 
 // console.c
 void consoleinit(void);
 void consoleintr(int);
 void consputc(int);
 
+// crc32c.c
+void crc32cinit(void);
+uint crc32c(uint, const void *, int);
+
 // exec.c
 int exec(char *, char **);
 
@@ -51,11 +75,32 @@ int namecmp(const char *, const char *);
 struct inode *namei(char *);
 struct inode *nameiparent(char *, char *);
 int readi(struct inode *, int, uint64, uint, uint);
+void iprefetch(struct inode *, uint, uint);
 void stati(struct inode *, struct stat *);
 int writei(struct inode *, int, uint64, uint, uint);
 uint bmap(struct inode *, uint);
 void itrunc(struct inode *);
 
+// raid.c
+void mirrorinit(void);
+void mirror_install_begin(void);
+void mirror_install_end(void);
+uint mirror_pbn(int, uint);
+int mirror_rw_user(uint, uint64, int);
+int mirror_read_leg(uint);
+void mirror_read_done(int);
+int mirror_canread(int, uint);
+int mirror_set_policy(int);
+void mirror_stat(struct iostat *);
+void mirror_loadwib(struct superblock *);
+void mirror_mark(int, uint);
+void mirror_loadcsum(struct superblock *);
+void mirror_setcsum(struct buf *, uint);
+void mirror_csumflush(void);
+int mirror_csumok(struct buf *);
+int mirror_check(struct buf *, int);
+int mirror_resync(void);
+
 // ramdisk.c
 void ramdiskinit(void);
 void ramdiskintr(void);
@@ -64,13 +109,19 @@ void ramdiskrw(struct buf *);
 // kalloc.c
 void *kalloc(void);
 void kfree(void *);
+int kfreepages(void);
 void kinit(void);
 
 // log.c
 void initlog(int, struct superblock *);
 void log_write(struct buf *);
+void log_data(struct buf *);
+void log_free(uint);
+int log_freed(uint);
 void begin_op(void);
 void end_op(void);
+void log_sync(int);
+void log_stat(struct iostat *);
 
 // pipe.c
 int pipealloc(struct file **, struct file **);
@@ -91,6 +142,7 @@ int growproc(int);
 pagetable_t proc_pagetable(struct proc *);
 void proc_freepagetable(pagetable_t, uint64);
 int kill(int);
+int kthread_create(void (*)(void *), void *, char *);
 struct cpu *mycpu(void);
 struct cpu *getmycpu(void);
 struct proc *myproc();
@@ -99,9 +151,11 @@ void scheduler(void) __attribute__((noreturn));
 void sched(void);
 void setproc(struct proc *);
 void sleep(void *, struct spinlock *);
+void sleep_timeout(void *, struct spinlock *, int);
 void userinit(void);
 int wait(uint64);
 void wakeup(void *);
+void wakeup_timeout(void);
 void yield(void);
 int either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int either_copyin(void *dst, int user_src, uint64 src, uint64 len);
@@ -182,8 +236,12 @@ void plic_complete(int);
 
 // virtio_disk.c
 void virtio_disk_init(void);
-void virtio_disk_rw(struct buf *, int);
-void virtio_disk_intr(void);
+void virtio_disk_rwn(struct buf **, int, int *, uint *, int, int);
+int virtio_disk_submit(struct bioreq *, int);
+void virtio_disk_wait(struct bioreq **, int);
+void virtio_disk_flush(int *, int);
+void virtio_disk_stat(struct iostat *);
+void virtio_disk_intr(int);
 
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x) / sizeof((x)[0]))
@@ -13,6 +13,9 @@
 #include "stat.h"
 #include "proc.h"
 
+#define RA_MIN 2 // first read-ahead window, in blocks
+#define RA_MAX 8 // largest; each block in flight holds a buffer
+
 struct devsw devsw[NDEV];
 struct
 {
@@ -101,6 +104,37 @@ int filestat(struct file *f, uint64 addr)
     return -1;
 }
 
+// Sequential read-ahead. A read that starts where the last one
+// ended doubles the window, from RA_MIN up to RA_MAX blocks, and
+// prefetches the blocks of the window past it not asked for yet.
+// Any other read closes the window.
+// Called after reading n bytes at off. Caller holds f->ip->lock.
+static void readahead(struct file *f, uint off, uint n)
+{
+    uint next = (off + n + BSIZE - 1) / BSIZE; // first block not read
+    uint start;
+
+    if (off != f->ra_off)
+        f->ra_win = 0;
+    else if (f->ra_win == 0)
+        f->ra_win = RA_MIN;
+    else if (2 * f->ra_win <= RA_MAX)
+        f->ra_win *= 2;
+    f->ra_off = off + n;
+
+    if (f->ra_win == 0)
+    {
+        f->ra_end = 0;
+        return;
+    }
+    start = f->ra_end > next ? f->ra_end : next;
+    if (start < next + f->ra_win)
+    {
+        iprefetch(f->ip, start, next + f->ra_win - start);
+        f->ra_end = next + f->ra_win;
+    }
+}
+
 // Read from file f.
 // addr is a user virtual address.
 int fileread(struct file *f, uint64 addr, int n)
@@ -124,7 +158,10 @@ int fileread(struct file *f, uint64 addr, int n)
     {
         ilock(f->ip);
         if ((r = readi(f->ip, 1, addr, f->off, n)) > 0)
+        {
+            readahead(f, f->off, r);
             f->off += r;
+        }
         iunlock(f->ip);
     }
     else
@@ -158,11 +195,17 @@ int filewrite(struct file *f, uint64 addr, int n)
     {
         // write a few blocks at a time to avoid exceeding
         // the maximum log transaction size, including
-        // i-node, indirect block, allocation blocks,
-        // and 2 blocks of slop for non-aligned writes.
+        // i-node, up to 3 levels of indirect blocks, allocation
+        // blocks, and 2 blocks of slop for non-aligned writes.
         // this really belongs lower down, since writei()
         // might be writing a device like the console.
-        int max = ((MAXOPBLOCKS - 1 - 1 - 2) / 2) * BSIZE;
+        // in ordered mode the data blocks are not logged,
+        // and only 1 block of slop counts against them.
+#ifdef LOG_ORDERED
+        int max = (MAXDATABLOCKS - 1) * BSIZE;
+#else
+        int max = ((MAXOPBLOCKS - 1 - 3 - 2) / 2) * BSIZE;
+#endif
         int i = 0;
         while (i < n)
         {
@@ -13,6 +13,9 @@ struct file
     struct pipe *pipe; // FD_PIPE
     struct inode *ip;  // FD_INODE and FD_DEVICE
     uint off;          // FD_INODE
+    uint ra_off;       // FD_INODE: where a sequential read would start
+    uint ra_win;       // FD_INODE: read-ahead window, in blocks
+    uint ra_end;       // FD_INODE: first block not yet read ahead
     short major;       // FD_DEVICE
 };
 
@@ -34,7 +37,10 @@ struct inode
     short mode;
     short nlink;
     uint size;
-    uint addrs[NDIRECT + 1];
+    uint addrs[NADDR];
+    uint bmbn;   // bmap() cache: file blocks bmbn .. bmbn+bmlen-1
+    uint bmaddr; // are at disk blocks bmaddr ..
+    uint bmlen;
 };
 
 // map major device number to device functions.
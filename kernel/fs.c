@@ -42,46 +42,61 @@ void fsinit(int dev)
     readsb(dev, &sb);
     if (sb.magic != FSMAGIC)
         panic("invalid file system");
+    if (!(sb.features & (FS_EXTENTS | FS_BIGMAP)))
+        panic("old file system format");
+    mirror_loadwib(&sb);
+    mirror_loadcsum(&sb);
     initlog(dev, &sb);
 }
 
-// Zero a block.
-static void bzero(int dev, int bno)
+// Zero a block, a file data block if data is set.
+static void bzero(int dev, int bno, int data)
 {
     struct buf *bp;
 
     bp = bread(dev, bno);
     memset(bp->data, 0, BSIZE);
-    log_write(bp);
+    if (data)
+        log_data(bp);
+    else
+        log_write(bp);
     brelse(bp);
 }
 
 // Blocks.
 
-// Allocate a zeroed disk block.
-static uint balloc(uint dev)
+// Allocate a zeroed disk block, for file data if data is set: the
+// first free one at or after goal, wrapping around to the start of
+// the disk. Skips blocks the log says must not be reused yet.
+static uint balloc(uint dev, uint goal, int data)
 {
-    int b, bi, m;
+    int i, b, bi, m;
     struct buf *bp;
 
     bp = 0;
-    for (b = 0; b < sb.size; b += BPB)
+    if (goal >= sb.size)
+        goal = 0;
+    for (i = 0; i < sb.size; i++)
     {
-        bp = bread(dev, BBLOCK(b, sb));
-        for (bi = 0; bi < BPB && b + bi < sb.size; bi++)
+        b = (goal + i) % sb.size;
+        if (bp == 0 || bp->blockno != BBLOCK(b, sb))
         {
-            m = 1 << (bi % 8);
-            if ((bp->data[bi / 8] & m) == 0)
-            {                          // Is block free?
-                bp->data[bi / 8] |= m; // Mark block in use.
-                log_write(bp);
+            if (bp)
                 brelse(bp);
-                bzero(dev, b + bi);
-                return b + bi;
-            }
+            bp = bread(dev, BBLOCK(b, sb));
+        }
+        bi = b % BPB;
+        m = 1 << (bi % 8);
+        if ((bp->data[bi / 8] & m) == 0 && !log_freed(b))
+        {                          // Is block free?
+            bp->data[bi / 8] |= m; // Mark block in use.
+            log_write(bp);
+            brelse(bp);
+            bzero(dev, b, data);
+            return b;
         }
-        brelse(bp);
     }
+    brelse(bp);
     panic("balloc: out of blocks");
 }
 
@@ -99,6 +114,7 @@ static void bfree(int dev, uint b)
     bp->data[bi / 8] &= ~m;
     log_write(bp);
     brelse(bp);
+    log_free(b);
 }
 
 // Inodes.
@@ -310,6 +326,7 @@ void ilock(struct inode *ip)
         ip->size = dip->size;
         memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
         brelse(bp);
+        ip->bmlen = 0;
         ip->valid = 1;
         if (ip->type == 0)
             panic("ilock: no type");
@@ -372,91 +389,262 @@ void iunlockput(struct inode *ip)
 // The content (data) associated with each inode is stored
 // in blocks on the disk. The first NDIRECT block numbers
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// listed in block ip->addrs[NDIRECT], the next NINDIRECT^2 in the
+// blocks listed in ip->addrs[NDIRECT+1], and the next NINDIRECT^3
+// one level further down from ip->addrs[NDIRECT+2]. Or, if the
+// file system has FS_EXTENTS, ip->addrs[] holds extents (see fs.h).
+
+// The extent slot i of ip's list: inline, or in the extent block,
+// which the caller has read into *bp.
+static struct extent *eslot(struct inode *ip, struct buf *bp, int i)
+{
+    if (i < NIEXTENT)
+        return (struct extent *)ip->addrs + i;
+    return (struct extent *)bp->data + (i - NIEXTENT);
+}
 
-// Return the disk block address of the nth block in inode ip.
-// If there is no such block, bmap allocates one.
+// Return the disk block address of the nth block in extent inode
+// ip, and in *n how many blocks of its extent start there. If bn is
+// just past the end of the file, allocate it: right after the last
+// extent, which grows, if that block is free, else in a new extent.
+// Returns 0 if that takes an extent and all MAXEXTENT are in use.
+static uint emap(struct inode *ip, uint bn, uint *n)
+{
+    struct buf *bp = 0;
+    struct extent *e = 0;
+    uint base = 0, addr;
+    int i;
 
-uint bmap(struct inode *ip, uint bn)
+    for (i = 0; i < MAXEXTENT; i++)
+    {
+        if (i == NIEXTENT)
+        {
+            if (ip->addrs[XADDR] == 0)
+                break;
+            bp = bread(ip->dev, ip->addrs[XADDR]);
+        }
+        if (eslot(ip, bp, i)->len == 0)
+            break;
+        e = eslot(ip, bp, i);
+        if (bn < base + e->len)
+        {
+            addr = e->start + (bn - base);
+            *n = e->len - (bn - base);
+            if (bp)
+                brelse(bp);
+            ip->bmbn = base;
+            ip->bmaddr = e->start;
+            ip->bmlen = e->len;
+            return addr;
+        }
+        base += e->len;
+    }
+    if (bn != base)
+        panic("emap: hole");
+
+    addr = balloc(ip->dev, e ? e->start + e->len : 0, ip->type == T_FILE);
+    if (e && addr == e->start + e->len)
+    {
+        base -= e->len;
+        e->len++;
+    }
+    else if (i == MAXEXTENT)
+    {
+        bfree(ip->dev, addr);
+        if (bp)
+            brelse(bp);
+        return 0;
+    }
+    else
+    {
+        if (i == NIEXTENT && bp == 0)
+        {
+            ip->addrs[XADDR] = balloc(ip->dev, 0, 0);
+            bp = bread(ip->dev, ip->addrs[XADDR]);
+        }
+        e = eslot(ip, bp, i);
+        e->start = addr;
+        e->len = 1;
+    }
+    if (bp && i >= NIEXTENT)
+        log_write(bp); // the inline extents go with iupdate()
+    if (bp)
+        brelse(bp);
+    ip->bmbn = base;
+    ip->bmaddr = e->start;
+    ip->bmlen = e->len;
+    *n = 1;
+    return addr;
+}
+
+// Return the disk block address of the nth block in indirect inode
+// ip, and in *n how many consecutive blocks the last block of
+// addresses on the way lists from there. If there is no such
+// block, allocate it, and the indirect blocks above it.
+static uint imap(struct inode *ip, uint bn, uint *n)
 {
-    uint addr, *a;
-    struct buf *bp;
+    uint fbn = bn, addr, span, *slot, *a = 0;
+    struct buf *bp = 0;
+    int level, k;
 
-    if (bn < NDIRECT) //
+    *n = 1;
+    if (bn < NDIRECT)
     {
         if ((addr = ip->addrs[bn]) == 0)
         {
-            addr = balloc(ip->dev);
-            if (addr == 0)
-                panic("bmap: balloc failed");
+            addr = balloc(ip->dev, 0, ip->type == T_FILE);
             ip->addrs[bn] = addr;
         }
         return addr;
     }
+
+    // which of the single, double and triple indirect trees, each
+    // span blocks big, holds bn, and where in it.
     bn -= NDIRECT;
-    if (bn < NINDIRECT)
+    for (level = 1, span = NINDIRECT; bn >= span; level++, span *= NINDIRECT)
     {
-        if ((addr = ip->addrs[NDIRECT]) == 0)
+        if (level == 3)
         {
-            addr = balloc(ip->dev);
-            if (addr == 0)
-                panic("bmap: balloc failed for indirect block");
-            ip->addrs[NDIRECT] = addr;
+            printf("bmap: ERROR! file_bn %d is out of range for inode %d\n",
+                   fbn, ip->inum);
+            panic("bmap: out of range");
         }
+        bn -= span;
+    }
 
+    // walk down from the inode; at level 0, slot is the data
+    // block's entry in bp, the last indirect block.
+    slot = &ip->addrs[NDIRECT + level - 1];
+    for (;;)
+    {
+        if ((addr = *slot) == 0)
+        {
+            addr = balloc(ip->dev, 0, level == 0 && ip->type == T_FILE);
+            *slot = addr;
+            if (bp)
+                log_write(bp);
+        }
+        if (level == 0)
+            break;
+        if (bp)
+            brelse(bp);
         bp = bread(ip->dev, addr);
         a = (uint *)bp->data;
+        span /= NINDIRECT;
+        slot = &a[bn / span];
+        bn %= span;
+        level--;
+    }
 
-        uint target_addr = a[bn];
-
-        if (target_addr == 0)
-        {
-            target_addr = balloc(ip->dev);
-            if (target_addr == 0)
-                panic("bmap: balloc failed for data block via indirect");
-            a[bn] = target_addr;
-            log_write(bp);
-        }
-        brelse(bp);
+    for (k = 1; slot + k < a + NINDIRECT && slot[k] == addr + k; k++)
+        ;
+    brelse(bp);
+    ip->bmbn = fbn;
+    ip->bmaddr = addr;
+    ip->bmlen = *n = k;
+    return addr;
+}
 
-        return target_addr;
+// Return the disk block address of the nth block in inode ip, and
+// in *n how many consecutive blocks are known to start there.
+// If there is no such block, allocate one. Returns 0 if the file
+// cannot grow that far. A block in the run the last lookup found
+// needs no lookup, and no indirect or extent block read.
+static uint bmapn(struct inode *ip, uint bn, uint *n)
+{
+    if (bn - ip->bmbn < ip->bmlen)
+    {
+        *n = ip->bmlen - (bn - ip->bmbn);
+        return ip->bmaddr + (bn - ip->bmbn);
     }
+    if (sb.features & FS_EXTENTS)
+        return emap(ip, bn, n);
+    return imap(ip, bn, n);
+}
 
-    printf("bmap: ERROR! file_bn %d is out of range for inode %d\n",
-           bn + NDIRECT, ip->inum);
-    panic("bmap: out of range");
+// Return the disk block address of the nth block in inode ip.
+// If there is no such block, bmap allocates one.
+uint bmap(struct inode *ip, uint bn)
+{
+    uint n;
+
+    return bmapn(ip, bn, &n);
 }
 
-// Truncate inode (discard contents).
-// Caller must hold ip->lock.
-void itrunc(struct inode *ip)
+// Free the blocks of extent inode ip, and its extent block.
+static void etrunc(struct inode *ip)
 {
-    int i, j;
-    struct buf *bp;
-    uint *a;
+    struct buf *bp = 0;
+    struct extent *e;
+    int i;
+    uint j;
 
-    for (i = 0; i < NDIRECT; i++)
+    for (i = 0; i < MAXEXTENT; i++)
     {
-        if (ip->addrs[i])
+        if (i == NIEXTENT)
         {
-            bfree(ip->dev, ip->addrs[i]);
-            ip->addrs[i] = 0;
+            if (ip->addrs[XADDR] == 0)
+                break;
+            bp = bread(ip->dev, ip->addrs[XADDR]);
         }
+        e = eslot(ip, bp, i);
+        if (e->len == 0)
+            break;
+        for (j = 0; j < e->len; j++)
+            bfree(ip->dev, e->start + j);
     }
+    if (bp)
+    {
+        brelse(bp);
+        bfree(ip->dev, ip->addrs[XADDR]);
+    }
+    memset(ip->addrs, 0, sizeof(ip->addrs));
+}
 
-    if (ip->addrs[NDIRECT])
+// Free indirect block addr, level levels above the data blocks,
+// and every block under it.
+static void ifree(struct inode *ip, uint addr, int level)
+{
+    struct buf *bp;
+    uint *a;
+    int j;
+
+    if (level > 0)
     {
-        bp = bread(ip->dev, ip->addrs[NDIRECT]);
+        bp = bread(ip->dev, addr);
         a = (uint *)bp->data;
         for (j = 0; j < NINDIRECT; j++)
         {
             if (a[j])
-                bfree(ip->dev, a[j]);
+                ifree(ip, a[j], level - 1);
         }
         brelse(bp);
-        bfree(ip->dev, ip->addrs[NDIRECT]);
-        ip->addrs[NDIRECT] = 0;
     }
+    bfree(ip->dev, addr);
+}
+
+// Truncate inode (discard contents).
+// Caller must hold ip->lock.
+void itrunc(struct inode *ip)
+{
+    int i;
+
+    if (sb.features & FS_EXTENTS)
+    {
+        etrunc(ip);
+    }
+    else
+    {
+        for (i = 0; i < NADDR; i++)
+        {
+            if (ip->addrs[i])
+            {
+                ifree(ip, ip->addrs[i], i < NDIRECT ? 0 : i - NDIRECT + 1);
+                ip->addrs[i] = 0;
+            }
+        }
+    }
+    ip->bmlen = 0;
 
     ip->size = 0;
     iupdate(ip);
@@ -475,6 +663,27 @@ void stati(struct inode *ip, struct stat *st)
     st->mode = ip->mode;
 }
 
+// Lock the buffers of file blocks bn .. last of ip, or as many of
+// them from bn on as lie in consecutive disk blocks, up to NBATCH,
+// and read them in one disk request. Returns how many are in bp[],
+// 0 if the file cannot grow to bn. bmap() allocates blocks as for
+// writing; an extent gives its whole run at once.
+static int breadrun(struct inode *ip, uint bn, uint last, struct buf **bp)
+{
+    uint addr, n, k;
+
+    if ((addr = bmapn(ip, bn, &n)) == 0)
+        return 0;
+    if (n > last - bn + 1)
+        n = last - bn + 1;
+    if (n > NBATCH)
+        n = NBATCH;
+    while (n < NBATCH && bn + n <= last && bmapn(ip, bn + n, &k) == addr + n)
+        n++;
+    breadn(ip->dev, addr, n, bp);
+    return n;
+}
+
 // Read data from inode.
 // Caller must hold ip->lock.
 // If user_dst==1, then dst is a user virtual address;
@@ -482,7 +691,8 @@ void stati(struct inode *ip, struct stat *st)
 int readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
 {
     uint tot, m;
-    struct buf *bp;
+    struct buf *bp[NBATCH];
+    int i, nb;
 
     if (!(ip->type == T_FILE || ip->type == T_SYMLINK || ip->type == T_DIR))
         return -1;
@@ -492,20 +702,37 @@ int readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
     if (off + n > ip->size)
         n = ip->size - off;
 
-    for (tot = 0; tot < n; tot += m, off += m, dst += m)
+    for (tot = 0; tot < n;)
     {
-        bp = bread(ip->dev, bmap(ip, off / BSIZE));
-        m = min(n - tot, BSIZE - off % BSIZE);
-        if (either_copyout(user_dst, dst, bp->data + (off % BSIZE), m) == -1)
+        nb = breadrun(ip, off / BSIZE, (off + n - tot - 1) / BSIZE, bp);
+        for (i = 0; i < nb; i++, tot += m, off += m, dst += m)
         {
-            brelse(bp);
-            break;
+            m = min(n - tot, BSIZE - off % BSIZE);
+            if (either_copyout(user_dst, dst, bp[i]->data + (off % BSIZE),
+                               m) == -1)
+            {
+                while (i < nb)
+                    brelse(bp[i++]);
+                return tot;
+            }
+            brelse(bp[i]);
         }
-        brelse(bp);
     }
     return tot;
 }
 
+// Start reading blocks bn .. bn+n-1 of ip into the buffer cache,
+// without waiting for them. Blocks past the end of the file are
+// skipped, so bmap() never allocates here.
+// Caller must hold ip->lock.
+void iprefetch(struct inode *ip, uint bn, uint n)
+{
+    uint nb = (ip->size + BSIZE - 1) / BSIZE;
+
+    for (; n > 0 && bn < nb; n--, bn++)
+        bprefetch(ip->dev, bmap(ip, bn));
+}
+
 // Write data to inode.
 // Caller must hold ip->lock.
 // If user_src==1, then src is a user virtual address;
@@ -513,27 +740,40 @@ int readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
 int writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
 {
     uint tot, m;
-    struct buf *bp;
+    struct buf *bp[NBATCH];
+    int i, nb;
 
+    // the size field is the limit: MAXFILE blocks of indirect
+    // mapping are more than a uint can count bytes of.
     if (off > ip->size || off + n < off)
         return -1;
-    if (off + n > MAXFILE * BSIZE)
-        return -1;
 
-    for (tot = 0; tot < n; tot += m, off += m, src += m)
+    for (tot = 0; tot < n;)
     {
-        uint bn = off / BSIZE;
-        uint disk_lbn = bmap(ip, bn);
-        bp = bread(ip->dev, disk_lbn);
-        m = min(n - tot, BSIZE - off % BSIZE);
-        if (either_copyin(bp->data + (off % BSIZE), user_src, src, m) == -1)
+        nb = breadrun(ip, off / BSIZE, (off + n - tot - 1) / BSIZE, bp);
+        if (nb == 0)
         {
-            brelse(bp);
+            n = tot; // out of extents
             break;
         }
-        log_write(bp);
-        brelse(bp);
+        for (i = 0; i < nb; i++, tot += m, off += m, src += m)
+        {
+            m = min(n - tot, BSIZE - off % BSIZE);
+            if (either_copyin(bp[i]->data + (off % BSIZE), user_src, src,
+                              m) == -1)
+            {
+                while (i < nb)
+                    brelse(bp[i++]);
+                goto out;
+            }
+            if (ip->type == T_FILE)
+                log_data(bp[i]);
+            else
+                log_write(bp[i]);
+            brelse(bp[i]);
+        }
     }
+out:
 
     if (n > 0)
     {
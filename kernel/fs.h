@@ -6,7 +6,7 @@
 
 // Disk layout:
 // [ boot block | super block | log | inode blocks |
-//                                          free bit map | data blocks]
+//   free bit map | write-intent bit maps | checksum table | data blocks]
 //
 // mkfs computes the super block and builds an initial file system. The
 // super block describes the disk layout:
@@ -20,13 +20,27 @@ struct superblock
     uint logstart;   // Block number of first log block
     uint inodestart; // Block number of first inode block
     uint bmapstart;  // Block number of first free map block
+    uint wibstart;   // Block number of first write-intent map block
+    uint nwib;       // Number of write-intent map blocks
+    uint csumstart;  // Block number of first checksum table block
+    uint ncsum;      // Number of checksum table blocks
+    uint features;   // FS_* format options; 0 in older images
 };
 
 #define FSMAGIC 0x10203040
 
-#define NDIRECT 12
+#define FS_EXTENTS 0x1 // inodes map their blocks by extents
+#define FS_BIGMAP 0x2  // or by the block addresses below
+
+// With FS_BIGMAP, an inode's addrs[] holds NDIRECT direct block
+// addresses, then those of a single, a double and a triple indirect
+// block. Images with neither feature had 12 direct blocks and a
+// single indirect one, and cannot be mounted.
+#define NDIRECT 10
 #define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define NADDR (NDIRECT + 3)
+#define MAXFILE (NDIRECT + NINDIRECT + NINDIRECT * NINDIRECT + \
+                 NINDIRECT * NINDIRECT * NINDIRECT)
 
 // On-disk inode structure
 struct dinode
@@ -37,9 +51,26 @@ struct dinode
     short mode;
     short nlink;             // Number of links to inode in file system
     uint size;               // Size of file (bytes)
-    uint addrs[NDIRECT + 1]; // Data block addresses
+    uint addrs[NADDR];       // Data block addresses
+};
+
+// With FS_EXTENTS, an inode's blocks are listed as extents, runs of
+// consecutive disk blocks, in file order; a file has no holes, so
+// an extent's first file block is the sum of the lengths before it.
+// addrs[0..XADDR-1] hold NIEXTENT extents, and addrs[XADDR] the
+// extent block holding the next NXEXTENT. The list ends at the first
+// extent of length 0.
+struct extent
+{
+    uint start; // first disk block
+    uint len;   // number of blocks
 };
 
+#define XADDR (NADDR - 1)
+#define NIEXTENT (XADDR * sizeof(uint) / sizeof(struct extent))
+#define NXEXTENT (BSIZE / sizeof(struct extent))
+#define MAXEXTENT (NIEXTENT + NXEXTENT)
+
 // Inodes per block.
 #define IPB (BSIZE / sizeof(struct dinode))
 
@@ -52,6 +83,18 @@ struct dinode
 // Block of free map containing bit for block b
 #define BBLOCK(b, sb) ((b) / BPB + sb.bmapstart)
 
+// Write-intent bit map blocks per RAID-1 leg. Leg l's map starts at
+// sb.wibstart + l * WIBBLOCKS and has a bit set for each block that
+// missed a write on that leg and awaits resync.
+#define WIBBLOCKS (LOGICAL_DISK_SIZE / BPB + 1)
+
+// Checksums per block
+#define CPB (BSIZE / sizeof(uint))
+
+// Checksum table blocks. The table holds the CRC32C of the contents
+// of every block, except the write-intent maps and the table itself.
+#define CSBLOCKS ((LOGICAL_DISK_SIZE + CPB - 1) / CPB)
+
 // Directory is a file containing a sequence of dirent structures.
 #define DIRSIZ 14
 
@@ -0,0 +1,32 @@
+// Block I/O statistics, filled in by the iostat() system call.
+// Both the kernel and user programs use this header file.
+// Counters only ever grow; sample twice and subtract.
+
+struct iostat
+{
+    uint64 bhits;   // buffer cache lookups that found their block
+    uint64 bmisses; // lookups that had to fill a buffer
+    uint64 bbufs;   // buffers in the cache now (not a counter)
+    uint64 bgrown;  // slabs of buffers the cache grew by
+    uint64 bshrunk; // slabs it gave back when memory ran out
+
+    uint64 raissued; // read-ahead reads started
+    uint64 rahits;   // lookups that found a block read ahead for them
+    uint64 rawasted; // blocks read ahead but recycled unused
+
+    uint64 lcommits;   // log transactions committed
+    uint64 llogged;    // blocks they logged
+    uint64 lwaits;     // FS calls that waited for log space
+    uint64 linstalled; // logged blocks checkpoints wrote home
+    uint64 labsorbed;  // and left to a newer transaction's copy
+
+    uint64 mreads[2]; // reads served by each RAID-1 leg
+    uint64 mstale;    // blocks stale on a leg, waiting for resync
+    uint64 mresynced; // stale blocks copied back by resync
+    uint64 mcsumerr;  // copies read that failed their checksum
+    uint64 mcsumlost; // blocks with no copy that passed it
+    uint64 vqstalls;  // disk requests that found the virtio ring full
+    uint64 vflushes;  // write cache flushes sent to the disks
+
+    uint64 tlost; // trace events dropped because a ring was full
+};
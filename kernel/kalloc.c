@@ -1,6 +1,6 @@
 // Physical memory allocator, for user processes,
-// kernel stacks, page-table pages,
-// and pipe buffers. Allocates whole 4096-byte pages.
+// kernel stacks, page-table pages, pipe buffers
+// and the buffer cache. Allocates whole 4096-byte pages.
 
 #include "types.h"
 #include "param.h"
@@ -23,6 +23,7 @@ struct
 {
     struct spinlock lock;
     struct run *freelist;
+    int nfree; // pages on freelist
 } kmem;
 
 void kinit()
@@ -58,6 +59,7 @@ void kfree(void *pa)
     acquire(&kmem.lock);
     r->next = kmem.freelist;
     kmem.freelist = r;
+    kmem.nfree++;
     release(&kmem.lock);
 }
 
@@ -71,10 +73,21 @@ void *kalloc(void)
     acquire(&kmem.lock);
     r = kmem.freelist;
     if (r)
+    {
         kmem.freelist = r->next;
+        kmem.nfree--;
+    }
     release(&kmem.lock);
 
     if (r)
         memset((char *)r, 5, PGSIZE); // fill with junk
     return (void *)r;
 }
+
+// Number of free pages, for the buffer cache to decide whether
+// to grow or shrink. Only a hint: it may change as soon as it is
+// returned.
+int kfreepages(void)
+{
+    return kmem.nfree;
+}
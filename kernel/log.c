@@ -6,6 +6,7 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "iostat.h"
 
 // Simple logging that allows concurrent FS system calls.
 //
@@ -19,39 +20,130 @@
 // its start and end. Usually begin_op() just increments
 // the count of in-progress FS system calls and returns.
 // But if it thinks the log is close to running out, it
-// sleeps until the last outstanding end_op() commits.
+// sleeps until the log daemon commits.
 //
-// The log is a physical re-do log containing disk blocks.
-// The on-disk log format:
-//   header block, containing block #s for block A, B, C, ...
+// end_op() does not commit: the log daemon, a kernel thread,
+// does, once no FS system calls are active and the transaction
+// is COMMIT_AGE ticks old, or fills half the log, or somebody
+// waits for it (begin_op() short of space, log_sync() for fsync()
+// and sync()). So write() returns without waiting for the disk,
+// and updates to the same block by several system calls reach the
+// log once; a process that needs its writes durable asks.
+//
+// The log is split into two regions, used in turn. To commit,
+// the daemon first copies the transaction's blocks into the
+// cache buffers of the next region's log slots; only this copy
+// holds up new FS system calls. They then build the next
+// transaction while the daemon writes the copies to the log.
+//
+// A commit ends with the header write. The daemon installs, or
+// checkpoints, a region's blocks at their home locations later:
+// before the region is needed for another transaction, once it
+// has held them CHECKPOINT_AGE ticks, or for log_sync(). Until
+// then the home buffers stay pinned in the cache. A block that
+// the newer region also holds is not installed from the older
+// one: the newer copy will be, or recovery will replay it.
+//
+// In ordered mode (make LOG_MODE=ordered, the default), file data
+// blocks are not logged: log_data() pins them, and the daemon
+// writes them home just before the transaction that allocated or
+// grew them commits. A block freed by a transaction is not reused
+// until that transaction commits, so a crash cannot leave its old
+// owner pointing at someone else's data; and a block about to be
+// written as data is first checkpointed if the older region still
+// holds it as metadata, so the checkpoint cannot overwrite it.
+//
+// The on-disk format of each region:
+//   header block, containing a sequence number, the sequence
+//     number checkpointed through when it was written, and
+//     block #s and checksums for block A, B, C, ...
 //   block A
 //   block B
 //   block C
 //   ...
-// Log appends are synchronous.
+// A header is written once, together with its blocks, and never
+// cleared. Recovery trusts a region only if the header's checksum
+// and all its blocks' checksums match, and replays the trusted
+// regions the newest of them does not record as checkpointed.
+// Log appends are synchronous, in the daemon.
+//
+// The disks may cache writes, so a finished write is not yet safe
+// from a crash; bflush() makes it so. A commit flushes twice: after
+// the data blocks, which must not be overtaken by the header, and
+// after the log, before it counts as done. A checkpoint flushes
+// once, before the next header can record it or its region be
+// overwritten. Writes in between are not ordered among themselves.
 
-// Contents of the header block, used for both the on-disk header block
-// and to keep track in memory of logged block# before commit.
+// Contents of a region's header block, used for both the on-disk
+// header block and to keep track in memory of logged block# before
+// commit.
 struct logheader
 {
     int n;
+    uint seq;           // transactions commit in increasing seq order
+    uint ckpt;          // all up to this seq were home when written
+    uint crc;           // crc32c of the header, with crc 0
+    uint sum[LOGSIZE];  // crc32c of each logged block
     int block[LOGSIZE];
 };
 
+// Hash indexes from block number to slot in a transaction's block
+// list, so that absorption and lookups need not scan it. Sizes are
+// powers of 2, at least twice the lists'; entries are slot + 1, or
+// 0 if free.
+#define LOGHASH 256
+#define DATAHASH 1024
+
+#define COMMIT_AGE 10     // ticks a transaction may stay uncommitted
+#define CHECKPOINT_AGE 50 // ticks it may stay committed but not home
+
 struct log
 {
     struct spinlock lock;
     int start;
-    int size;
+    int size;        // blocks in each region, header included
     int outstanding; // how many FS sys calls are executing.
-    int committing;  // in commit(), please wait.
+    int committing;  // copying lh out for commit(), please wait.
     int dev;
-    struct logheader lh;
+    struct logheader lh; // the transaction being built
+    ushort lhidx[LOGHASH];
+    int region;          // the region lh will be committed to
+    struct buf *data[NDATA]; // file data blocks lh's calls wrote, pinned
+    int dblock[NDATA];       // and their block numbers
+    int ndata;
+    ushort dataidx[DATAHASH];
+    uchar freed[2][LOGICAL_DISK_SIZE / 8]; // blocks each region's
+                                           // transaction freed
+    uint since;          // ticks when lh gained its first block.
+    int want;            // somebody waits for a commit.
+    int wantckpt;        // somebody waits for a checkpoint.
+    uint done;           // seq of the last transaction on disk.
+    uint ckpt;           // seq of the last one checkpointed.
+    uint64 ncommit;      // commits done.
+    uint64 nlogged;      // blocks they logged.
+    uint64 nwait;        // begin_op() calls that waited.
+    uint64 ninstalled;   // blocks checkpoints wrote home.
+    uint64 nabsorbed;    // blocks they left to a newer transaction.
 };
 struct log log;
 
+// The transaction each region holds, committed but not yet
+// checkpointed if n > 0, the log slot buffers holding its blocks,
+// locked, and the home buffers log_write() pinned. Only the log
+// daemon (or recovery, before it starts) uses them.
+static struct logheader clh[2];
+static ushort cidx[2][LOGHASH];
+static struct buf *cbuf[2][LOGSIZE];
+static struct buf *hbuf[2][LOGSIZE];
+static struct buf *cdata[NDATA]; // the data blocks of the one frozen last
+static int ncdata;
+static uint ctime[2]; // ticks at commit
+
 static void recover_from_log(void);
-static void commit();
+static void freeze(int);
+static void commit(int);
+static void checkpoint(int);
+static void logd(void *);
 
 void initlog(int dev, struct superblock *sb)
 {
@@ -60,66 +152,203 @@ void initlog(int dev, struct superblock *sb)
 
     initlock(&log.lock, "log");
     log.start = sb->logstart;
-    log.size = sb->nlog;
+    log.size = sb->nlog / 2;
     log.dev = dev;
     recover_from_log();
+    if (kthread_create(logd, 0, "logd") < 0)
+        panic("initlog: logd");
 }
 
-// Copy committed blocks from log to their home location
-static void install_trans(void)
+// Block number of region r's header; its log slots follow.
+static uint region_start(int r)
 {
-    int tail;
+    return log.start + r * log.size;
+}
 
-    for (tail = 0; tail < log.lh.n; tail++)
-    {
-        struct buf *lbuf =
-            bread(log.dev, log.start + tail + 1);              // read log block
-        struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-        memmove(dbuf->data, lbuf->data, BSIZE); // copy block to dst
-        bwrite(dbuf);                           // write dst to disk
-        bunpin(dbuf);
-        brelse(lbuf);
-        brelse(dbuf);
-    }
+// Wait for the write r. If home, r installed blocks whose home
+// buffers, home[0..r->n-1], log_write() pinned: unpin them, now that
+// the disk has the blocks.
+static void log_wait(struct bioreq *r, struct buf **home)
+{
+    int i;
+
+    bwait(&r, 1);
+    for (i = 0; home && i < r->n; i++)
+        bunpin(home[i]);
 }
 
-// Read the log header from disk into the in-memory log header
-static void read_head(void)
+// Wait for the data write r, then unpin and release its buffers.
+static void data_wait(struct bioreq *r)
 {
-    struct buf *buf = bread(log.dev, log.start);
-    struct logheader *lh = (struct logheader *)(buf->data);
     int i;
-    log.lh.n = lh->n;
-    for (i = 0; i < log.lh.n; i++)
+
+    log_wait(r, r->bp);
+    for (i = 0; i < r->n; i++)
+        brelse(r->bp[i]);
+}
+
+// The slot of block b in the list key, indexed by idx of size
+// n, or -1 if it is not there.
+static int ifind(ushort *idx, int n, int *key, int b)
+{
+    uint h;
+
+    for (h = ((uint)b * 2654435761U) >> 8; idx[h & (n - 1)] != 0; h++)
+        if (key[idx[h & (n - 1)] - 1] == b)
+            return idx[h & (n - 1)] - 1;
+    return -1;
+}
+
+// Record in idx, of size n, that block b is in slot i.
+static void iadd(ushort *idx, int n, int b, int i)
+{
+    uint h;
+
+    for (h = ((uint)b * 2654435761U) >> 8; idx[h & (n - 1)] != 0; h++)
+        ;
+    idx[h & (n - 1)] = i + 1;
+}
+
+// Is block b in region r's transaction?
+static int inregion(int r, int b)
+{
+    return ifind(cidx[r], LOGHASH, clh[r].block, b) >= 0;
+}
+
+// Write region r's blocks from its log slot buffers straight to
+// their home locations, except those the other region's newer
+// transaction holds, which are only unpinned. Each run of
+// consecutive home blocks is written with one request, two
+// requests at a time. Returns the number written.
+//
+// The home buffers are not touched: they may already hold a newer
+// transaction's changes. When recovering there are none cached.
+// So it is the mirror's copy lock, not their locks, that keeps the
+// resync daemon from copying a block back meanwhile.
+static int install_trans(int r, int recovering)
+{
+    static struct buf *slot[LOGSIZE], *home[LOGSIZE];
+    static int block[LOGSIZE];
+    struct bioreq req[2];
+    int at[2];
+    int tail, i, n, k, nb;
+
+    for (nb = 0, i = 0; i < clh[r].n; i++)
     {
-        log.lh.block[i] = lh->block[i];
+        if (!recovering && inregion(r ^ 1, clh[r].block[i]))
+        {
+            bunpin(hbuf[r][i]);
+            continue;
+        }
+        block[nb] = clh[r].block[i];
+        home[nb] = hbuf[r][i];
+        slot[nb++] = cbuf[r][i];
     }
+
+    mirror_install_begin();
+    for (tail = 0, k = 0; tail < nb; tail += n, k++)
+    {
+        for (n = 1; n < NBATCH && tail + n < nb &&
+                    block[tail + n] == block[tail] + n;
+             n++)
+            ;
+        if (k >= 2)
+            log_wait(&req[k % 2], recovering ? 0 : &home[at[k % 2]]);
+        at[k % 2] = tail;
+        bwritestart_at(&req[k % 2], &slot[tail], n, block[tail]);
+    }
+    for (i = k >= 2 ? k - 2 : 0; i < k; i++)
+        log_wait(&req[i % 2], recovering ? 0 : &home[at[i % 2]]);
+    mirror_install_end();
+    return nb;
+}
+
+// Read region r's header from disk into *lh.
+static void read_head(int r, struct logheader *lh)
+{
+    struct buf *buf = bread(log.dev, region_start(r));
+    memmove(lh, buf->data, sizeof(*lh));
     brelse(buf);
 }
 
-// Write in-memory log header to disk.
-// This is the true point at which the
-// current transaction commits.
-static void write_head(void)
+// Checksum of *lh, computed with its crc field 0.
+static uint head_crc(struct logheader *lh)
 {
-    struct buf *buf = bread(log.dev, log.start);
-    struct logheader *hb = (struct logheader *)(buf->data);
-    int i;
-    hb->n = log.lh.n;
-    for (i = 0; i < log.lh.n; i++)
+    uint crc = lh->crc, c;
+
+    lh->crc = 0;
+    c = crc32c(0, lh, sizeof(*lh));
+    lh->crc = crc;
+    return c;
+}
+
+// Did region r's transaction, just read, reach the disk whole?
+// Reads its log slots into cbuf[r] if so.
+static int region_ok(int r)
+{
+    struct logheader *lh = &clh[r];
+    int i, ok;
+
+    if (lh->n < 1 || lh->n > LOGSIZE || head_crc(lh) != lh->crc)
+        return 0;
+    for (i = 0, ok = 1; i < lh->n; i++)
     {
-        hb->block[i] = log.lh.block[i];
+        cbuf[r][i] = bread(log.dev, region_start(r) + 1 + i);
+        if (crc32c(0, cbuf[r][i]->data, BSIZE) != lh->sum[i])
+            ok = 0;
     }
-    bwrite(buf);
-    brelse(buf);
+    if (!ok)
+        for (i = 0; i < lh->n; i++)
+            brelse(cbuf[r][i]);
+    return ok;
 }
 
+// Release region r's log slot buffers.
+static void release_slots(int r)
+{
+    int i;
+
+    for (i = 0; i < clh[r].n; i++)
+        brelse(cbuf[r][i]);
+}
+
+// Install the committed transactions left in the two regions that
+// the newer one does not record as checkpointed, the older first.
+// The next transaction goes to the region after the newer one.
 static void recover_from_log(void)
 {
-    read_head();
-    install_trans(); // if committed, copy from log to disk
-    log.lh.n = 0;
-    write_head(); // clear the log
+    int ok[2], k, r, first;
+    uint ckpt;
+
+    for (r = 0; r < 2; r++)
+    {
+        read_head(r, &clh[r]);
+        ok[r] = region_ok(r);
+    }
+    if (ok[0] && ok[1])
+        first = (int)(clh[1].seq - clh[0].seq) < 0 ? 1 : 0;
+    else
+        first = ok[0] ? 1 : 0; // "older" is the region not trusted
+    ckpt = ok[first ^ 1] ? clh[first ^ 1].ckpt : 0;
+
+    for (k = 0; k < 2; k++)
+    {
+        r = first ^ k;
+        if (!ok[r])
+        {
+            clh[r].n = 0;
+            continue;
+        }
+        if ((int)(clh[r].seq - ckpt) > 0)
+            install_trans(r, 1); // if committed, copy from log to disk
+        release_slots(r);
+        clh[r].n = 0;
+    }
+    mirror_csumflush();
+    bflush();
+    log.region = first;
+    log.done = log.ckpt = ok[first ^ 1] ? clh[first ^ 1].seq : 0;
+    log.lh.seq = log.done + 1;
 }
 
 // called at the start of each FS system call.
@@ -132,9 +361,13 @@ void begin_op(void)
         {
             sleep(&log, &log.lock);
         }
-        else if (log.lh.n + (log.outstanding + 1) * MAXOPBLOCKS > LOGSIZE)
+        else if (log.lh.n + (log.outstanding + 1) * MAXOPBLOCKS > LOGSIZE ||
+                 log.ndata + (log.outstanding + 1) * MAXDATABLOCKS > NDATA)
         {
             // this op might exhaust log space; wait for commit.
+            log.want = 1;
+            log.nwait++;
+            wakeup(&log.want);
             sleep(&log, &log.lock);
         }
         else
@@ -147,19 +380,18 @@ void begin_op(void)
 }
 
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// lets the log daemon commit if this was the last outstanding
+// operation.
 void end_op(void)
 {
-    int do_commit = 0;
-
     acquire(&log.lock);
     log.outstanding -= 1;
     if (log.committing)
         panic("log.committing");
     if (log.outstanding == 0)
     {
-        do_commit = 1;
-        log.committing = 1;
+        if (log.want)
+            wakeup(&log.want);
     }
     else
     {
@@ -169,45 +401,259 @@ void end_op(void)
         wakeup(&log);
     }
     release(&log.lock);
+}
 
-    if (do_commit)
+// Should the log daemon commit now? Caller holds log.lock.
+static int commitdue(void)
+{
+    if (log.outstanding > 0 || log.lh.n == 0)
+        return 0;
+    return log.want || log.lh.n >= LOGSIZE / 2 || log.ndata >= NDATA / 2 ||
+           ticks - log.since >= COMMIT_AGE;
+}
+
+// The log daemon. Sleeps until a commit or checkpoint is due,
+// waking for those who want one, and every tick while the log
+// holds anything, to check its age. The region the next commit
+// goes to holds the older transaction, if any.
+static void logd(void *arg)
+{
+    int r;
+
+    acquire(&log.lock);
+    for (;;)
     {
-        // call commit w/o holding locks, since not allowed
-        // to sleep with locks.
-        commit();
-        acquire(&log.lock);
-        log.committing = 0;
-        wakeup(&log);
-        release(&log.lock);
+        r = log.region;
+        if (commitdue() && clh[r].n > 0)
+        {
+            release(&log.lock);
+            checkpoint(r); // make room
+            acquire(&log.lock);
+            continue;
+        }
+        if (commitdue())
+        {
+            log.committing = 1;
+            log.want = 0;
+            release(&log.lock);
+
+            // call freeze and commit w/o holding locks, since
+            // not allowed to sleep with locks.
+            freeze(r);
+            commit(r);
+
+            acquire(&log.lock);
+            continue;
+        }
+
+        if (clh[r].n == 0)
+            r ^= 1;
+        if (clh[r].n == 0)
+        {
+            log.wantckpt = 0;
+        }
+        else if (log.wantckpt || ticks - ctime[r] >= CHECKPOINT_AGE)
+        {
+            release(&log.lock);
+            checkpoint(r);
+            acquire(&log.lock);
+            continue;
+        }
+        sleep_timeout(&log.want, &log.lock,
+                      log.lh.n > 0 || clh[r].n > 0 ? 1 : 0);
     }
 }
 
-// Copy modified blocks from cache to log.
-static void write_log(void)
+// Commit everything logged so far and wait until it is on disk:
+// committed, which recovery makes as good as home, or, if home,
+// installed at home too (sync(), for raw disk readers).
+void log_sync(int home)
 {
-    int tail;
+    uint seq;
 
-    for (tail = 0; tail < log.lh.n; tail++)
+    acquire(&log.lock);
+    // the last transaction handed to commit() has every block
+    // logged before now, unless the one being built has some.
+    seq = log.lh.n > 0 ? log.lh.seq : log.lh.seq - 1;
+    if (log.lh.n > 0)
+        log.want = 1;
+    while ((int)((home ? log.ckpt : log.done) - seq) < 0)
     {
-        struct buf *to = bread(log.dev, log.start + tail + 1); // log block
-        struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-        memmove(to->data, from->data, BSIZE);
-        bwrite(to); // write the log
+        if (home)
+            log.wantckpt = 1;
+        wakeup(&log.want);
+        sleep(&log, &log.lock);
+    }
+    release(&log.lock);
+}
+
+// Copy the blocks of the transaction being built from the cache
+// into the log slots of region r, move it to clh[r], and start the
+// next one in the other region. FS system calls wait meanwhile.
+static void freeze(int r)
+{
+    struct buf *b;
+    int i, j;
+
+    for (i = 0; i < log.lh.n; i++)
+    {
+        // the log block is overwritten whole: no need to read it.
+        cbuf[r][i] = bget(log.dev, region_start(r) + 1 + i);
+        struct buf *from = bread(log.dev, log.lh.block[i]);
+        memmove(cbuf[r][i]->data, from->data, BSIZE);
+        cbuf[r][i]->valid = 1;
+        hbuf[r][i] = from;
         brelse(from);
-        brelse(to);
+        log.lh.sum[i] = crc32c(0, cbuf[r][i]->data, BSIZE);
+    }
+
+    // a data block logged as metadata since goes with the log.
+    for (i = ncdata = 0; i < log.ndata; i++)
+    {
+        if (ifind(log.lhidx, LOGHASH, log.lh.block, log.dblock[i]) >= 0)
+            bunpin(log.data[i]);
+        else
+            cdata[ncdata++] = log.data[i];
+    }
+
+    // in block order: write_data() locks each run while it holds the
+    // one before, and breadn() callers lock blocks in ascending order.
+    for (i = 1; i < ncdata; i++)
+    {
+        b = cdata[i];
+        for (j = i; j > 0 && cdata[j - 1]->blockno > b->blockno; j--)
+            cdata[j] = cdata[j - 1];
+        cdata[j] = b;
     }
+
+    acquire(&log.lock);
+    clh[r] = log.lh;
+    memmove(cidx[r], log.lhidx, sizeof(cidx[r]));
+    memset(log.lhidx, 0, sizeof(log.lhidx));
+    memset(log.dataidx, 0, sizeof(log.dataidx));
+    log.lh.n = 0;
+    log.ndata = 0;
+    log.lh.seq++;
+    log.region = r ^ 1;
+    log.committing = 0;
+    log.nlogged += clh[r].n;
+    wakeup(&log);
+    release(&log.lock);
 }
 
-static void commit()
+// Write region r's log slots and its header, and wait for them all
+// at once: the header's checksums tell recovery whether the rest
+// reached the disk, so it need not wait for them. The log is
+// contiguous, so NBATCH slots go in each request, two requests at
+// a time.
+static void write_log(int r)
 {
-    if (log.lh.n > 0)
+    struct bioreq req[2], hreq, *hr = &hreq;
+    struct buf *hb;
+    int tail, i, n, k;
+
+    // the header is overwritten whole: no need to read it.
+    hb = bget(log.dev, region_start(r));
+    memset(hb->data, 0, BSIZE);
+    acquire(&log.lock);
+    clh[r].ckpt = log.ckpt;
+    release(&log.lock);
+    clh[r].crc = head_crc(&clh[r]);
+    memmove(hb->data, &clh[r], sizeof(clh[r]));
+    hb->valid = 1;
+    bwritestart(&hreq, &hb, 1);
+
+    for (tail = 0, k = 0; tail < clh[r].n; tail += n, k++)
+    {
+        n = clh[r].n - tail < NBATCH ? clh[r].n - tail : NBATCH;
+        if (k >= 2)
+            log_wait(&req[k % 2], 0);
+        bwritestart(&req[k % 2], &cbuf[r][tail], n); // write the log
+    }
+    for (i = k >= 2 ? k - 2 : 0; i < k; i++)
+        log_wait(&req[i % 2], 0);
+    bwait(&hr, 1);
+    brelse(hb);
+}
+
+// Write the data blocks of the transaction frozen last home, and
+// unpin them: it must not commit before they are on disk. Each run
+// of consecutive blocks is written with one request, two requests
+// at a time; freeze() sorted them, so the runs are locked in block
+// order. If the other region, r ^ 1, still has to install one
+// of them as metadata, checkpoint it first.
+static void write_data(int r)
+{
+    struct buf *bp[NBATCH];
+    struct bioreq req[2];
+    int tail, i, n, k;
+
+    for (i = 0; i < ncdata; i++)
+    {
+        if (inregion(r ^ 1, cdata[i]->blockno))
+        {
+            checkpoint(r ^ 1);
+            break;
+        }
+    }
+
+    for (tail = 0, k = 0; tail < ncdata; tail += n, k++)
+    {
+        for (n = 1; n < NBATCH && tail + n < ncdata &&
+                    cdata[tail + n]->blockno == cdata[tail]->blockno + n;
+             n++)
+            ;
+        if (k >= 2)
+            data_wait(&req[k % 2]);
+        breadn(log.dev, cdata[tail]->blockno, n, bp); // cached, pinned
+        bwritestart(&req[k % 2], bp, n);
+    }
+    for (i = k >= 2 ? k - 2 : 0; i < k; i++)
+        data_wait(&req[i % 2]);
+    ncdata = 0;
+}
+
+// Write region r's transaction to the log: the real commit. Then
+// the blocks it freed may be reused.
+static void commit(int r)
+{
+    if (ncdata > 0)
     {
-        write_log();     // Write modified blocks from cache to log
-        write_head();    // Write header to disk -- the real commit
-        install_trans(); // Now install writes to home locations
-        log.lh.n = 0;
-        write_head(); // Erase the transaction from the log
+        write_data(r);
+        bflush();
     }
+    write_log(r);
+    bflush();
+
+    acquire(&log.lock);
+    log.done = clh[r].seq;
+    log.ncommit++;
+    ctime[r] = ticks;
+    memset(log.freed[r], 0, sizeof(log.freed[r]));
+    wakeup(&log);
+    release(&log.lock);
+}
+
+// Install region r's transaction at home, and the checksum table
+// with their sums. The region's header stays: the next header
+// written records the checkpoint.
+static void checkpoint(int r)
+{
+    int n;
+
+    n = install_trans(r, 0);
+    release_slots(r);
+    mirror_csumflush(); // with the sums of the blocks installed
+    bflush();
+
+    acquire(&log.lock);
+    log.ninstalled += n;
+    log.nabsorbed += clh[r].n - n;
+    clh[r].n = 0;
+    memset(cidx[r], 0, sizeof(cidx[r]));
+    log.ckpt = clh[r].seq;
+    wakeup(&log);
+    release(&log.lock);
 }
 
 // Caller has modified b->data and is done with the buffer.
@@ -229,16 +675,77 @@ void log_write(struct buf *b)
         panic("log_write outside of trans");
 
     acquire(&log.lock);
-    for (i = 0; i < log.lh.n; i++)
-    {
-        if (log.lh.block[i] == b->blockno) // log absorbtion
-            break;
-    }
-    log.lh.block[i] = b->blockno;
-    if (i == log.lh.n)
+    i = ifind(log.lhidx, LOGHASH, log.lh.block, b->blockno); // absorbtion
+    if (i < 0)
     { // Add new block to log?
+        i = log.lh.n;
+        log.lh.block[i] = b->blockno;
+        iadd(log.lhidx, LOGHASH, b->blockno, i);
         bpin(b);
-        log.lh.n++;
+        if (log.lh.n++ == 0)
+            log.since = ticks;
     }
     release(&log.lock);
 }
+
+#ifdef LOG_ORDERED
+// Caller has modified b->data, a file data block, and is done with
+// the buffer. Rather than logging it, pin it in the cache, and
+// record it to be written home before the transaction commits.
+void log_data(struct buf *b)
+{
+    if (log.outstanding < 1)
+        panic("log_data outside of trans");
+
+    acquire(&log.lock);
+    if (ifind(log.dataidx, DATAHASH, log.dblock, b->blockno) < 0)
+    {
+        if (log.ndata >= NDATA)
+            panic("too much data in a transaction");
+        bpin(b);
+        log.dblock[log.ndata] = b->blockno;
+        iadd(log.dataidx, DATAHASH, b->blockno, log.ndata);
+        log.data[log.ndata++] = b;
+    }
+    release(&log.lock);
+}
+
+// Block b has been freed by the transaction being built.
+void log_free(uint b)
+{
+    acquire(&log.lock);
+    log.freed[log.region][b / 8] |= 1 << (b % 8);
+    release(&log.lock);
+}
+
+// May block b not be reused yet: was it freed by a transaction that
+// has not committed?
+int log_freed(uint b)
+{
+    int m = 1 << (b % 8), f;
+
+    acquire(&log.lock);
+    f = ((log.freed[0][b / 8] | log.freed[1][b / 8]) & m) != 0;
+    release(&log.lock);
+    return f;
+}
+#else
+// Journal mode: file data is logged like everything else.
+void log_data(struct buf *b) { log_write(b); }
+
+void log_free(uint b) {}
+
+int log_freed(uint b) { return 0; }
+#endif
+
+// Add the log counters to *st.
+void log_stat(struct iostat *st)
+{
+    acquire(&log.lock);
+    st->lcommits = log.ncommit;
+    st->llogged = log.nlogged;
+    st->lwaits = log.nwait;
+    st->linstalled = log.ninstalled;
+    st->labsorbed = log.nabsorbed;
+    release(&log.lock);
+}
@@ -24,7 +24,10 @@ void main()
         trapinithart();     // install kernel trap vector
         plicinit();         // set up interrupt controller
         plicinithart();     // ask PLIC for device interrupts
+        crc32cinit();       // block checksums
         binit();            // buffer cache
+        mirrorinit();       // RAID-1 read policy
+        blktraceinit();     // block layer trace rings
         iinit();            // inode cache
         fileinit();         // file table
         virtio_disk_init(); // emulated hard disk
@@ -7,16 +7,29 @@
 #define ROOTDEV 1                 // device number of file system root disk
 #define MAXARG 32                 // max exec arguments
 #define MAXOPBLOCKS 10            // max # of blocks any FS op writes
-#define LOGSIZE (MAXOPBLOCKS * 3) // max data blocks in on-disk log
-#define NBUF (MAXOPBLOCKS * 3)    // size of disk block cache
+#define LOGSIZE (MAXOPBLOCKS * 12) // max data blocks in on-disk log
+#define MAXDATABLOCKS 32          // max # of file data blocks an FS op
+                                  // writes, in ordered mode
+#define NDATA (LOGSIZE / MAXOPBLOCKS * MAXDATABLOCKS) // and a transaction
+#define NBUF (5 * LOGSIZE + 2 * NDATA + MAXOPBLOCKS * 6) // minimum size
+                                  // of disk block cache: all the log may
+                                  // pin or hold at once, and room to spare
+#define BCACHE_FRAC 8             // block cache may grow to 1/8 of RAM
+#define NBATCH 8                  // max blocks in one disk request
 // #define FSSIZE 1000               // size of file system in blocks
+#ifndef FSSIZE
 #define FSSIZE 4096   // size of file system in blocks(1000->4096)
+#endif
 #define MAXPATH 128   // maximum file path name
 #define NPORT 128     // maximum number of ports
 #define NSOCK 32      // maximum number of sockets
 #define SBUFFSIZE 128 // size of buffer
 
 // --- RAID 1 Constants ---
-#define LOGICAL_DISK_SIZE (FSSIZE / 2)
-#define DISK1_START_BLOCK (FSSIZE / 2)
+// Each leg is a disk of its own, FSSIZE blocks long. Physical block
+// numbers (PBNs) name blocks on either: leg 1's start at
+// DISK1_START_BLOCK.
+#define NDISK 2
+#define LOGICAL_DISK_SIZE FSSIZE
+#define DISK1_START_BLOCK FSSIZE
 // --- End RAID 1 Constants ---
@@ -13,6 +13,7 @@ void plicinit(void)
     // set desired IRQ priorities non-zero (otherwise disabled).
     *(uint32 *)(PLIC + UART0_IRQ * 4) = 1;
     *(uint32 *)(PLIC + VIRTIO0_IRQ * 4) = 1;
+    *(uint32 *)(PLIC + VIRTIO1_IRQ * 4) = 1;
 }
 
 void plicinithart(void)
@@ -20,7 +21,8 @@ void plicinithart(void)
     int hart = cpuid();
 
     // set uart's enable bit for this hart's S-mode.
-    *(uint32 *)PLIC_SENABLE(hart) = (1 << UART0_IRQ) | (1 << VIRTIO0_IRQ);
+    *(uint32 *)PLIC_SENABLE(hart) =
+        (1 << UART0_IRQ) | (1 << VIRTIO0_IRQ) | (1 << VIRTIO1_IRQ);
 
     // set this hart's S-mode priority threshold to 0.
     *(uint32 *)PLIC_SPRIORITY(hart) = 0;
@@ -157,6 +157,8 @@ static void freeproc(struct proc *p)
     p->chan = 0;
     p->killed = 0;
     p->xstate = 0;
+    p->kfn = 0;
+    p->karg = 0;
     p->state = UNUSED;
 }
 
@@ -237,6 +239,36 @@ void userinit(void)
     release(&p->lock);
 }
 
+// A kernel thread's very first scheduling by scheduler()
+// will swtch to kthread_start.
+static void kthread_start(void)
+{
+    struct proc *p = myproc();
+
+    // Still holding p->lock from scheduler.
+    release(&p->lock);
+    p->kfn(p->karg);
+    panic("kthread returned");
+}
+
+// Start a kernel thread named name that runs fn(arg). It runs only
+// in the kernel, has no user memory, parent or open files, and
+// must never return. Returns 0, or -1 if no proc is free.
+int kthread_create(void (*fn)(void *), void *arg, char *name)
+{
+    struct proc *p;
+
+    if ((p = allocproc()) == 0)
+        return -1;
+    p->kfn = fn;
+    p->karg = arg;
+    p->context.ra = (uint64)kthread_start;
+    safestrcpy(p->name, name, sizeof(p->name));
+    p->state = RUNNABLE;
+    release(&p->lock);
+    return 0;
+}
+
 // Grow or shrink user memory by n bytes.
 // Return 0 on success, -1 on failure.
 int growproc(int n)
@@ -561,6 +593,7 @@ void forkret(void)
         // be run from main().
         first = 0;
         fsinit(ROOTDEV);
+        breclaiminit();
     }
 
     usertrapret();
@@ -569,6 +602,14 @@ void forkret(void)
 // Atomically release lock and sleep on chan.
 // Reacquires lock when awakened.
 void sleep(void *chan, struct spinlock *lk)
+{
+    sleep_timeout(chan, lk, 0);
+}
+
+// Like sleep(), but if n > 0 also wake up once n clock ticks have
+// passed, for kernel threads that have work both to wait for and
+// to do periodically.
+void sleep_timeout(void *chan, struct spinlock *lk, int n)
 {
     struct proc *p = myproc();
 
@@ -586,12 +627,14 @@ void sleep(void *chan, struct spinlock *lk)
 
     // Go to sleep.
     p->chan = chan;
+    p->wakeat = n > 0 ? ticks + n : 0;
     p->state = SLEEPING;
 
     sched();
 
     // Tidy up.
     p->chan = 0;
+    p->wakeat = 0;
 
     // Reacquire original lock.
     if (lk != &p->lock)
@@ -618,6 +661,24 @@ void wakeup(void *chan)
     }
 }
 
+// Wake up processes whose sleep_timeout() has run out.
+// Called by the clock interrupt, after it advances ticks.
+void wakeup_timeout(void)
+{
+    struct proc *p;
+
+    for (p = proc; p < &proc[NPROC]; p++)
+    {
+        acquire(&p->lock);
+        if (p->state == SLEEPING && p->wakeat != 0 &&
+            (int)(ticks - p->wakeat) >= 0)
+        {
+            p->state = RUNNABLE;
+        }
+        release(&p->lock);
+    }
+}
+
 // Wake up p if it is sleeping in wait(); used by exit().
 // Caller must hold p->lock.
 static void wakeup1(struct proc *p)
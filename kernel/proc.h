@@ -104,6 +104,7 @@ struct proc
     int killed;           // If non-zero, have been killed
     int xstate;           // Exit status to be returned to parent's wait
     int pid;              // Process ID
+    uint wakeat;          // If non-zero, tick at which to end a sleep
 
     // these are private to the process, so p->lock need not be held.
     uint64 kstack;               // Virtual address of kernel stack
@@ -114,4 +115,6 @@ struct proc
     struct file *ofile[NOFILE];  // Open files
     struct inode *cwd;           // Current directory
     char name[16];               // Process name (debugging)
+    void (*kfn)(void *);         // Kernel thread's function, or 0
+    void *karg;                  // and its argument
 };
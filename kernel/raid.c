@@ -0,0 +1,613 @@
+// RAID-1 mirror policy.
+//
+// The file system sees one logical disk of LOGICAL_DISK_SIZE blocks.
+// Every logical block lives twice, at the same block number on each
+// of two virtio disks, the legs. Physical block numbers (PBNs) name
+// them in one space: blockno on leg 0, blockno + DISK1_START_BLOCK
+// on leg 1. bwrite() writes both legs in parallel; a read needs only
+// one of them, and mirror_read_leg() picks which according to the
+// read policy:
+//
+// * RAID_READ_RR alternates between the legs.
+// * RAID_READ_LOR picks the leg with the fewest reads in flight.
+// * RAID_READ_LOCAL keeps a read on the leg whose last read was
+//   at or just before it, so sequential streams stay on one leg,
+//   and spreads everything else like RAID_READ_LOR.
+//
+// Simulated failures (force_disk_fail, force_fail) override the
+// policy: a failed leg is never chosen.
+//
+// A write that has to skip a leg first marks the block stale on
+// that leg in the leg's write-intent bit map, on disk. Reads avoid
+// a leg where their block is stale, and the resync daemon, in
+// mirror_resync(), copies stale blocks back from the other leg once
+// it is working again.
+//
+// Every block read from disk is checked against the CRC32C the
+// checksum table holds for it. A copy that fails is replaced by the
+// other leg's, and marked stale like a missed write, so that the
+// resync daemon rewrites it. The table is kept in memory, updated
+// by every write, and written back by each log checkpoint, and by
+// the resync daemon after its copies.
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "proc.h"
+#include "defs.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "buf.h"
+#include "raid.h"
+#include "iostat.h"
+#include "blktrace.h"
+
+extern int force_read_error_pbn;
+extern int force_disk_fail_id;
+
+// how far past a leg's last read still counts as "nearby"
+#define RAID_NEAR 8
+
+#define RESYNC_BATCH 8  // blocks copied between pauses
+#define RESYNC_PAUSE 1  // ticks to leave the disks to everyone else
+#define RESYNC_IDLE 10  // ticks to wait when nothing can be copied
+
+struct
+{
+    struct spinlock lock;
+    int policy;
+    int rr;          // next leg for round-robin and ties
+    int inflight[2]; // reads issued to each leg, not yet done
+    uint last[2];    // last block read from each leg
+    uint64 reads[2]; // reads served by each leg
+
+    // in-memory copy of the write-intent bit maps.
+    uint wibstart; // first map block on disk; 0 if the fs has none
+    uchar stale[2][WIBBLOCKS * BSIZE];
+    int nstale;      // bits set in stale[][]
+    uint64 resynced; // blocks copied back by mirror_resync()
+    int resyncing;   // a daemon runs mirror_resync(), using scratch
+
+    // in-memory copy of the checksum table.
+    uint csumstart; // first table block on disk; 0 if the fs has none
+    uint csum[CSBLOCKS * CPB];
+    uchar csdirty[CSBLOCKS]; // table blocks changed since written
+    uint64 csumerr;          // copies read that failed their checksum
+    uint64 csumlost;         // blocks with no copy that passed it
+} mirror;
+
+// for reading the maps at boot, and for the resync daemon's copies:
+// there is only ever one daemon.
+static struct buf scratch;
+static uchar scratchdata[BSIZE];
+
+// Checkpoints write blocks home from their log slots, without the
+// blocks' own cache buffers, so holding one of those does not keep
+// out writes of the block. resync1() and install_trans() hold this
+// instead.
+static struct sleeplock copylock;
+
+// for the raw disk system calls, which must not borrow the cache's
+// buffer for a block: it may hold changes not yet on disk.
+static struct buf rawbuf;
+static uchar rawdata[BSIZE];
+
+void mirrorinit(void)
+{
+    initlock(&mirror.lock, "mirror");
+    scratch.data = scratchdata;
+    initsleeplock(&copylock, "mirror.copy");
+    initsleeplock(&rawbuf.lock, "rawbuf");
+    rawbuf.data = rawdata;
+    mirror.policy = RAID_READ_LOCAL;
+}
+
+// Keep resync from copying blocks while the log writes them home.
+void mirror_install_begin(void) { acquiresleep(&copylock); }
+void mirror_install_end(void) { releasesleep(&copylock); }
+
+// Physical block number of logical block blockno on leg.
+uint mirror_pbn(int leg, uint blockno)
+{
+    return leg == 0 ? blockno : blockno + DISK1_START_BLOCK;
+}
+
+// Read or write b->data at physical block pbn, on whichever leg
+// it is, bypassing the mirror. b is one of the buffers above.
+static void mirror_rw_pbn(struct buf *b, uint pbn, int write)
+{
+    int leg = pbn >= DISK1_START_BLOCK;
+    uint blockno = pbn - leg * DISK1_START_BLOCK;
+
+    virtio_disk_rwn(&b, 1, &leg, &blockno, 1, write);
+}
+
+// Copy physical block pbn out to the user's buffer at addr, or if
+// write, write that buffer to it, bypassing the mirror and the
+// buffer cache. The cached copy of the block, if nobody holds it,
+// is dropped, so that the next read goes to the disk. For the
+// RAID-1 test system calls. Returns 0, or -1 if the copy fails.
+int mirror_rw_user(uint pbn, uint64 addr, int write)
+{
+    pagetable_t pt = myproc()->pagetable;
+    int r = 0;
+
+    acquiresleep(&rawbuf.lock);
+    if (write)
+        r = copyin(pt, (char *)rawbuf.data, addr, BSIZE);
+    if (r == 0)
+        mirror_rw_pbn(&rawbuf, pbn, write);
+    if (r == 0 && !write)
+        r = copyout(pt, addr, (char *)rawbuf.data, BSIZE);
+    releasesleep(&rawbuf.lock);
+
+    bforget(ROOTDEV, pbn % DISK1_START_BLOCK);
+    return r;
+}
+
+// The leg with fewer reads outstanding; alternate on a tie.
+// Caller holds mirror.lock.
+static int least_loaded(void)
+{
+    int leg;
+
+    if (mirror.inflight[0] != mirror.inflight[1])
+        return mirror.inflight[0] < mirror.inflight[1] ? 0 : 1;
+    leg = mirror.rr;
+    mirror.rr = !leg;
+    return leg;
+}
+
+// Is blockno stale on leg? Caller holds mirror.lock.
+static int isstale(int leg, uint blockno)
+{
+    return (mirror.stale[leg][blockno / 8] & (1 << (blockno % 8))) != 0;
+}
+
+// Is blockno at or shortly after the last read on leg?
+static int nearby(int leg, uint blockno)
+{
+    return blockno >= mirror.last[leg] &&
+           blockno - mirror.last[leg] <= RAID_NEAR;
+}
+
+// Choose the leg to read logical block blockno from, and count the
+// read as outstanding on it. Call mirror_read_done() when it finishes.
+int mirror_read_leg(uint blockno)
+{
+    int leg, policy, why = BT_WHY_POLICY;
+
+    acquire(&mirror.lock);
+    if (force_disk_fail_id == 0)
+        leg = 1, why = BT_WHY_DISKFAIL;
+    else if (force_read_error_pbn == blockno)
+        leg = 1, why = BT_WHY_BLOCKFAIL;
+    else if (force_disk_fail_id == 1)
+        leg = 0, why = BT_WHY_DISKFAIL;
+    else if (isstale(0, blockno))
+        leg = 1, why = BT_WHY_STALE;
+    else if (isstale(1, blockno))
+        leg = 0, why = BT_WHY_STALE;
+    else if (mirror.policy == RAID_READ_RR)
+    {
+        leg = mirror.rr;
+        mirror.rr = !leg;
+    }
+    else if (mirror.policy == RAID_READ_LOR)
+        leg = least_loaded();
+    else if (nearby(0, blockno) && !nearby(1, blockno))
+        leg = 0;
+    else if (nearby(1, blockno) && !nearby(0, blockno))
+        leg = 1;
+    else if (nearby(0, blockno))
+        leg = blockno - mirror.last[0] <= blockno - mirror.last[1] ? 0 : 1;
+    else
+        leg = least_loaded();
+
+    mirror.inflight[leg]++;
+    mirror.last[leg] = blockno;
+    mirror.reads[leg]++;
+    policy = mirror.policy;
+    release(&mirror.lock);
+    blktrace_log(BT_READ, mirror_pbn(leg, blockno), leg, why, policy);
+    return leg;
+}
+
+void mirror_read_done(int leg)
+{
+    acquire(&mirror.lock);
+    mirror.inflight[leg]--;
+    release(&mirror.lock);
+}
+
+// Select the read policy. Returns the previous one, or -1.
+int mirror_set_policy(int policy)
+{
+    int old;
+
+    if (policy < 0 || policy >= RAID_NPOLICY)
+        return -1;
+    acquire(&mirror.lock);
+    old = mirror.policy;
+    mirror.policy = policy;
+    release(&mirror.lock);
+    return old;
+}
+
+// Add the mirror counters to *st.
+void mirror_stat(struct iostat *st)
+{
+    acquire(&mirror.lock);
+    st->mreads[0] += mirror.reads[0];
+    st->mreads[1] += mirror.reads[1];
+    st->mstale += mirror.nstale;
+    st->mresynced += mirror.resynced;
+    st->mcsumerr += mirror.csumerr;
+    st->mcsumlost += mirror.csumlost;
+    release(&mirror.lock);
+}
+
+// Load the write-intent bit maps of the file system described by sb.
+// A leg's own copy of a map may be stale, having missed the writes
+// that marked it, so merge the copies from both legs.
+void mirror_loadwib(struct superblock *sb)
+{
+    int k, leg, i, n = 0;
+
+    if (sb->nwib != 2 * WIBBLOCKS)
+        return; // made before there were maps
+
+    for (k = 0; k < 2 * WIBBLOCKS; k++)
+    {
+        for (leg = 0; leg < 2; leg++)
+        {
+            mirror_rw_pbn(&scratch, mirror_pbn(leg, sb->wibstart + k), 0);
+            for (i = 0; i < BSIZE; i++)
+                mirror.stale[k / WIBBLOCKS][(k % WIBBLOCKS) * BSIZE + i] |=
+                    scratch.data[i];
+        }
+    }
+    for (i = 0; i < LOGICAL_DISK_SIZE; i++)
+        n += isstale(0, i) + isstale(1, i);
+
+    acquire(&mirror.lock);
+    mirror.wibstart = sb->wibstart;
+    mirror.nstale = n;
+    release(&mirror.lock);
+}
+
+// Write the map block holding leg's bit for blockno to both legs,
+// or whichever is working.
+static void wib_flush(int leg, uint blockno)
+{
+    uint k = blockno / BPB;
+    struct buf *b = bget(ROOTDEV, mirror.wibstart + leg * WIBBLOCKS + k);
+
+    acquire(&mirror.lock);
+    memmove(b->data, &mirror.stale[leg][k * BSIZE], BSIZE);
+    release(&mirror.lock);
+    b->valid = 1;
+    bwrite(b);
+    brelse(b);
+}
+
+// Record that a write of blockno is about to skip leg, but reach
+// the other leg, which so becomes the only up-to-date copy; or
+// that leg's copy failed its checksum and the other's did not.
+// Returns once the record is on disk. The caller holds the buffer
+// of blockno locked.
+void mirror_mark(int leg, uint blockno)
+{
+    int set, clr;
+
+    acquire(&mirror.lock);
+    if (mirror.wibstart == 0 || blockno >= LOGICAL_DISK_SIZE ||
+        (blockno >= mirror.wibstart &&
+         blockno < mirror.wibstart + 2 * WIBBLOCKS))
+    {
+        // the maps themselves are written whole, every time.
+        release(&mirror.lock);
+        return;
+    }
+    set = !isstale(leg, blockno);
+    clr = isstale(!leg, blockno);
+    mirror.stale[leg][blockno / 8] |= 1 << (blockno % 8);
+    mirror.stale[!leg][blockno / 8] &= ~(1 << (blockno % 8));
+    mirror.nstale += set - clr;
+    release(&mirror.lock);
+
+    if (set)
+        wib_flush(leg, blockno);
+    if (clr)
+        wib_flush(!leg, blockno);
+    if (set || clr)
+        bflush(); // past the disks' write caches
+}
+
+// Does blockno go unchecked: the maps, and the table itself,
+// which change in place outside of the table's view?
+// Caller holds mirror.lock.
+static int nocsum(uint blockno)
+{
+    return mirror.csumstart == 0 || blockno >= LOGICAL_DISK_SIZE ||
+           (blockno >= mirror.wibstart &&
+            blockno < mirror.csumstart + CSBLOCKS);
+}
+
+// Load the checksum table of the file system described by sb.
+// Call after mirror_loadwib(), so that the reads avoid stale legs.
+void mirror_loadcsum(struct superblock *sb)
+{
+    struct buf *b;
+    int k;
+
+    if (sb->ncsum != CSBLOCKS || sb->csumstart != sb->wibstart + sb->nwib)
+        return; // made before there was a table
+
+    for (k = 0; k < CSBLOCKS; k++)
+    {
+        b = bread(ROOTDEV, sb->csumstart + k);
+        memmove(&mirror.csum[k * CPB], b->data, BSIZE);
+        brelse(b);
+    }
+    acquire(&mirror.lock);
+    mirror.csumstart = sb->csumstart;
+    release(&mirror.lock);
+}
+
+// Record the checksum of b's contents, which are about to be
+// written to blockno. Caller holds b locked.
+void mirror_setcsum(struct buf *b, uint blockno)
+{
+    uint sum = crc32c(0, b->data, BSIZE);
+
+    acquire(&mirror.lock);
+    if (!nocsum(blockno))
+    {
+        mirror.csum[blockno] = sum;
+        mirror.csdirty[blockno / CPB] = 1;
+    }
+    release(&mirror.lock);
+}
+
+// Do b's contents match the checksum of its block, or is the block
+// unchecked? Safe to call from the disk interrupt.
+int mirror_csumok(struct buf *b)
+{
+    uint sum = crc32c(0, b->data, BSIZE);
+    int ok;
+
+    acquire(&mirror.lock);
+    ok = nocsum(b->blockno) || mirror.csum[b->blockno] == sum;
+    release(&mirror.lock);
+    return ok;
+}
+
+// Can leg's copy of blockno be read, given the simulated failures,
+// and is it up to date? Caller holds mirror.lock.
+static int canread(int leg, uint blockno)
+{
+    if (force_disk_fail_id == leg || isstale(leg, blockno))
+        return 0;
+    return leg != 0 || force_read_error_pbn != blockno;
+}
+
+// Can blockno be read from leg, as for canread()? For a run of
+// blocks read from the leg its first block was sent to.
+int mirror_canread(int leg, uint blockno)
+{
+    int ok;
+
+    acquire(&mirror.lock);
+    ok = canread(leg, blockno);
+    release(&mirror.lock);
+    return ok;
+}
+
+// b has just been read from leg. If that copy fails its checksum,
+// read the other leg's instead, and if it passes, have the resync
+// daemon rewrite the bad copy from it. If no copy passes, the table
+// must have missed a write before a crash: keep the copy last read,
+// and take its checksum. Returns the leg b's contents came from.
+// Caller holds b locked.
+int mirror_check(struct buf *b, int leg)
+{
+    int other = !leg, ok, policy;
+
+    if (mirror_csumok(b))
+        return leg;
+
+    acquire(&mirror.lock);
+    mirror.csumerr++;
+    ok = canread(other, b->blockno);
+    if (ok)
+        mirror.reads[other]++;
+    policy = mirror.policy;
+    release(&mirror.lock);
+
+    if (ok)
+    {
+        blktrace_log(BT_READ, mirror_pbn(other, b->blockno), other,
+                     BT_WHY_CSUM, policy);
+        virtio_disk_rwn(&b, 1, &other, &b->blockno, 1, 0);
+        if (mirror_csumok(b))
+        {
+            mirror_mark(leg, b->blockno);
+            return other;
+        }
+        acquire(&mirror.lock);
+        mirror.csumerr++;
+        release(&mirror.lock);
+        leg = other;
+    }
+
+    mirror_setcsum(b, b->blockno);
+    acquire(&mirror.lock);
+    mirror.csumlost++;
+    release(&mirror.lock);
+    return leg;
+}
+
+// Write the changed blocks of the checksum table to disk. Called
+// by checkpoint(), so that the table on disk trails the blocks it
+// covers by one checkpoint at most, whether or not there is a
+// resync daemon.
+void mirror_csumflush(void)
+{
+    struct buf *b;
+    int k;
+
+    for (k = 0; k < CSBLOCKS; k++)
+    {
+        acquire(&mirror.lock);
+        if (mirror.csumstart == 0 || !mirror.csdirty[k])
+        {
+            release(&mirror.lock);
+            continue;
+        }
+        release(&mirror.lock);
+
+        b = bget(ROOTDEV, mirror.csumstart + k);
+        acquire(&mirror.lock);
+        mirror.csdirty[k] = 0;
+        memmove(b->data, &mirror.csum[k * CPB], BSIZE);
+        release(&mirror.lock);
+        b->valid = 1;
+        bwrite(b);
+        brelse(b);
+    }
+}
+
+// Can the stale copy of blockno on leg be rewritten from the other
+// leg now, given the simulated failures?
+static int canresync(int leg, uint blockno)
+{
+    if (force_disk_fail_id == 0 || force_disk_fail_id == 1)
+        return 0;
+    return force_read_error_pbn != blockno;
+}
+
+// Copy blockno from the other leg to leg, where it is stale.
+static void resync1(int leg, uint blockno)
+{
+    struct buf *b;
+
+    // holding the cached buffer keeps out writes of the block, and
+    // with them mirror_mark(), but for a checkpoint's: copylock
+    // keeps out those. Take it after the buffer: while holding it,
+    // a checkpoint locks only map blocks, in mirror_mark(), and
+    // those are never stale.
+    b = bget(ROOTDEV, blockno);
+    acquiresleep(&copylock);
+    acquire(&mirror.lock);
+    if (!isstale(leg, blockno) || !canresync(leg, blockno))
+    {
+        release(&mirror.lock);
+        releasesleep(&copylock);
+        brelse(b);
+        return;
+    }
+    release(&mirror.lock);
+
+    mirror_rw_pbn(&scratch, mirror_pbn(!leg, blockno), 0);
+    mirror_rw_pbn(&scratch, mirror_pbn(leg, blockno), 1);
+    blktrace_log(BT_RESYNC, mirror_pbn(leg, blockno), leg, 0, 0);
+
+    acquire(&mirror.lock);
+    mirror.stale[leg][blockno / 8] &= ~(1 << (blockno % 8));
+    mirror.nstale--;
+    mirror.resynced++;
+    release(&mirror.lock);
+    releasesleep(&copylock);
+    brelse(b);
+}
+
+// Sleep for n clock ticks, or until killed.
+static void resync_pause(int n)
+{
+    uint ticks0;
+
+    acquire(&tickslock);
+    ticks0 = ticks;
+    while (ticks - ticks0 < n && !myproc()->killed)
+        sleep(&ticks, &tickslock);
+    release(&tickslock);
+}
+
+// The resync daemon: forever copy stale blocks back to the leg they
+// are stale on, RESYNC_BATCH at a time, pausing between batches so
+// that foreground I/O is not starved. The maps go to disk once per
+// batch, after a flush of the copies; a crash before that just
+// copies the batch again. The checksum table goes to disk before
+// each batch too, with the sums of the last one's copies.
+// Returns at once if another process is the daemon already, and
+// otherwise only if the calling process is killed.
+int mirror_resync(void)
+{
+    static uint next; // where the last batch left off
+    uint blockno, nscan;
+    int leg, n, flush[2];
+
+    acquire(&mirror.lock);
+    if (mirror.resyncing)
+    {
+        release(&mirror.lock);
+        return -1;
+    }
+    mirror.resyncing = 1;
+    release(&mirror.lock);
+
+    for (;;)
+    {
+        if (myproc()->killed)
+        {
+            acquire(&mirror.lock);
+            mirror.resyncing = 0;
+            release(&mirror.lock);
+            return -1;
+        }
+        mirror_csumflush();
+
+        acquire(&mirror.lock);
+        n = mirror.nstale;
+        release(&mirror.lock);
+        if (n == 0)
+        {
+            resync_pause(RESYNC_IDLE);
+            continue;
+        }
+
+        n = 0;
+        flush[0] = flush[1] = -1;
+        for (nscan = 0; nscan < LOGICAL_DISK_SIZE && n < RESYNC_BATCH;
+             nscan++)
+        {
+            blockno = next;
+            next = (next + 1) % LOGICAL_DISK_SIZE;
+            for (leg = 0; leg < 2; leg++)
+            {
+                acquire(&mirror.lock);
+                int todo = isstale(leg, blockno) && canresync(leg, blockno);
+                release(&mirror.lock);
+                if (!todo)
+                    continue;
+                resync1(leg, blockno);
+                if (flush[leg] >= 0 && flush[leg] != blockno / BPB)
+                {
+                    bflush(); // the copies, before the map clears them
+                    wib_flush(leg, flush[leg] * BPB);
+                }
+                flush[leg] = blockno / BPB;
+                n++;
+            }
+        }
+        if (flush[0] >= 0 || flush[1] >= 0)
+            bflush();
+        for (leg = 0; leg < 2; leg++)
+            if (flush[leg] >= 0)
+                wib_flush(leg, flush[leg] * BPB);
+
+        resync_pause(n > 0 ? RESYNC_PAUSE : RESYNC_IDLE);
+    }
+}
@@ -0,0 +1,7 @@
+// RAID-1 read policies, for set_read_policy().
+// Both the kernel and user programs use this header file.
+
+#define RAID_READ_RR 0    // alternate between the legs
+#define RAID_READ_LOR 1   // leg with the fewest reads outstanding
+#define RAID_READ_LOCAL 2 // keep streams on one leg, spread the rest
+#define RAID_NPOLICY 3
@@ -105,9 +105,16 @@ extern uint64 sys_raw_read(void);
 extern uint64 sys_get_disk_lbn(void);
 extern uint64 sys_raw_write(void);
 extern uint64 sys_force_disk_fail(void);
+extern uint64 sys_set_read_policy(void);
 /* TODO: Access Control & Symbolic Link */
 extern uint64 sys_symlink(void);
 extern uint64 sys_chmod(void);
+extern uint64 sys_iostat(void);
+extern uint64 sys_blktrace(void);
+extern uint64 sys_resync(void);
+extern uint64 sys_sync(void);
+extern uint64 sys_fsync(void);
+extern uint64 sys_set_bcache_max(void);
 
 static uint64 (*syscalls[])(void) = {
     [SYS_fork] sys_fork,
@@ -138,7 +145,14 @@ static uint64 (*syscalls[])(void) = {
     [SYS_get_disk_lbn] sys_get_disk_lbn,
     [SYS_raw_write] sys_raw_write,
     [SYS_force_disk_fail] sys_force_disk_fail,
+    [SYS_set_read_policy] sys_set_read_policy,
     [SYS_chmod] sys_chmod,
+    [SYS_iostat] sys_iostat,
+    [SYS_blktrace] sys_blktrace,
+    [SYS_resync] sys_resync,
+    [SYS_sync] sys_sync,
+    [SYS_fsync] sys_fsync,
+    [SYS_set_bcache_max] sys_set_bcache_max,
 };
 
 void syscall(void)
@@ -30,3 +30,11 @@
 /* TODO: Access Control & Symbolic Link */
 #define SYS_chmod 28
 #define SYS_symlink 29
+
+#define SYS_iostat 30
+#define SYS_set_read_policy 31
+#define SYS_blktrace 32
+#define SYS_resync 33
+#define SYS_sync 34
+#define SYS_fsync 35
+#define SYS_set_bcache_max 36
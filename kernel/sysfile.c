@@ -27,6 +27,8 @@
 #include "fcntl.h"
 //
 #include "buf.h"
+//
+#include "iostat.h"
 
 #define MAXPATH 128
 
@@ -489,6 +491,9 @@ static uint64 sys_open_internal(char *path, int omode)
     f->major = ip->major;
     f->ip = ip;
     f->off = 0;
+    f->ra_off = 0;
+    f->ra_win = 0;
+    f->ra_end = 0;
     if ((omode & O_NOACCESS) && ip->type != T_SYMLINK)
     {
         f->readable = 0;
@@ -714,35 +719,18 @@ uint64 sys_raw_read(void)
 {
     int pbn;
     uint64 user_buf_addr;
-    struct buf *b;
 
     if (argint(0, &pbn) < 0 || argaddr(1, &user_buf_addr) < 0)
     {
         return -1;
     }
 
-    if (pbn < 0 || pbn >= FSSIZE)
-    {
-        return -1;
-    }
-
-    b = bget(ROOTDEV, pbn);
-    if (b == 0)
-    {
-        return -1;
-    }
-
-    virtio_disk_rw(b, 0);
-
-    struct proc *p = myproc();
-    if (copyout(p->pagetable, user_buf_addr, (char *)b->data, BSIZE) < 0)
+    if (pbn < 0 || pbn >= DISK1_START_BLOCK + LOGICAL_DISK_SIZE)
     {
-        brelse(b);
         return -1;
     }
 
-    brelse(b);
-    return 0;
+    return mirror_rw_user(pbn, user_buf_addr, 0);
 }
 
 uint64 sys_get_disk_lbn(void)
@@ -777,34 +765,82 @@ uint64 sys_raw_write(void)
 {
     int pbn;
     uint64 user_buf_addr;
-    struct buf *b;
 
     if (argint(0, &pbn) < 0 || argaddr(1, &user_buf_addr) < 0)
     {
         return -1;
     }
 
-    if (pbn < 0 || pbn >= FSSIZE)
+    if (pbn < 0 || pbn >= DISK1_START_BLOCK + LOGICAL_DISK_SIZE)
     {
         return -1;
     }
 
-    b = bget(ROOTDEV, pbn);
-    if (b == 0)
-    {
-        printf("sys_raw_write: bget failed for PBN %d\n", pbn);
+    return mirror_rw_user(pbn, user_buf_addr, 1);
+}
+
+// Copy the block I/O counters out to the user's struct iostat.
+uint64 sys_iostat(void)
+{
+    uint64 addr;
+    struct iostat st;
+
+    if (argaddr(0, &addr) < 0)
         return -1;
-    }
-    struct proc *p = myproc();
-    if (copyin(p->pagetable, (char *)b->data, user_buf_addr, BSIZE) < 0)
-    {
-        brelse(b);
+
+    memset(&st, 0, sizeof(st));
+    bstat(&st);
+    log_stat(&st);
+    mirror_stat(&st);
+    virtio_disk_stat(&st);
+    blktrace_stat(&st);
+
+    if (copyout(myproc()->pagetable, addr, (char *)&st, sizeof(st)) < 0)
         return -1;
-    }
+    return 0;
+}
+
+// Limit the buffer cache to n buffers, or as near as it may come.
+// Returns the previous limit.
+uint64 sys_set_bcache_max(void)
+{
+    int n;
+
+    if (argint(0, &n) < 0)
+        return -1;
+    return bsetmax(n);
+}
+
+// Move up to n block trace events, oldest first, into the user's
+// array of struct blkevent. A null array discards all pending events.
+uint64 sys_blktrace(void)
+{
+    uint64 addr;
+    int n;
 
-    b->valid = 1;
-    virtio_disk_rw(b, 1);
-    brelse(b);
+    if (argaddr(0, &addr) < 0 || argint(1, &n) < 0)
+        return -1;
+    if (addr == 0)
+        n = __INT_MAX__;
+    return blktrace_drain(addr, n);
+}
+
+// Wait until all file system changes made so far are on disk.
+uint64 sys_sync(void)
+{
+    log_sync(1);
+    return 0;
+}
 
+// Wait until the file system changes made so far, fd's among them,
+// are durable. There is no per-file state to flush: the log commits
+// everything together, and file data goes out with the commit.
+uint64 sys_fsync(void)
+{
+    struct file *f;
+
+    if (argfd(0, 0, &f) < 0)
+        return -1;
+    log_sync(0);
     return 0;
 }
@@ -119,4 +119,18 @@ uint64 sys_force_disk_fail(void)
     return 0;
 }
 
+// System call to choose how reads are spread over the two legs
+// (RAID_READ_* in raid.h). Returns the previous policy.
+uint64 sys_set_read_policy(void)
+{
+    int policy;
+    if (argint(0, &policy) < 0)
+        return -1;
+    return mirror_set_policy(policy);
+}
+
+// Become the mirror resync daemon. Returns only when killed, or
+// at once, with -1, if there is one already.
+uint64 sys_resync(void) { return mirror_resync(); }
+
 // --- End RAID 1 Test Hook Syscall ---
@@ -159,6 +159,7 @@ void clockintr()
     acquire(&tickslock);
     ticks++;
     wakeup(&ticks);
+    wakeup_timeout();
     release(&tickslock);
 }
 
@@ -184,7 +185,11 @@ int devintr()
         }
         else if (irq == VIRTIO0_IRQ)
         {
-            virtio_disk_intr();
+            virtio_disk_intr(0);
+        }
+        else if (irq == VIRTIO1_IRQ)
+        {
+            virtio_disk_intr(1);
         }
         else if (irq)
         {
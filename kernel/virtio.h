@@ -37,6 +37,7 @@
 
 // device feature bits
 #define VIRTIO_BLK_F_RO 5          /* Disk is read-only */
+#define VIRTIO_BLK_F_FLUSH 9       /* Flush command, and a write cache */
 #define VIRTIO_BLK_F_SCSI 7        /* Supports scsi command passthru */
 #define VIRTIO_BLK_F_CONFIG_WCE 11 /* Writeback mode available in config */
 #define VIRTIO_BLK_F_MQ 12         /* support more than one vq */
@@ -46,7 +47,7 @@
 
 // this many virtio descriptors.
 // must be a power of two.
-#define NUM 8
+#define NUM 32
 
 struct VRingDesc
 {
@@ -67,6 +68,17 @@ struct VRingUsedElem
 // for disk ops
 #define VIRTIO_BLK_T_IN 0  // read the disk
 #define VIRTIO_BLK_T_OUT 1 // write the disk
+#define VIRTIO_BLK_T_FLUSH 4 // flush the disk's write cache
+
+// the format of the first descriptor in a disk request.
+// to be followed by two more descriptors containing
+// the block, and a one-byte status.
+struct virtio_blk_outhdr
+{
+    uint32 type; // VIRTIO_BLK_T_IN, ..._OUT or ..._FLUSH
+    uint32 reserved;
+    uint64 sector;
+};
 
 struct UsedArea
 {
@@ -1,10 +1,20 @@
 //
-// driver for qemu's virtio disk device.
+// driver for qemu's virtio disk devices.
 // uses qemu's mmio interface to virtio.
 // qemu presents a "legacy" virtio interface.
 //
 // qemu ... -drive file=fs.img,if=none,format=raw,id=x0 -device
 // virtio-blk-device,drive=x0,bus=virtio-mmio-bus.0
+// -drive file=fs1.img,if=none,format=raw,id=x1 -device
+// virtio-blk-device,drive=x1,bus=virtio-mmio-bus.1
+//
+// there is one instance of the driver state per disk, each with
+// its own queue and lock, so the disks work in parallel.
+//
+// a disk that offers VIRTIO_BLK_F_FLUSH gets to keep a write cache:
+// a write finishes once the device has the data, which may be lost
+// in a crash until a flush request, virtio_disk_flush(), finishes.
+// callers order their writes with flushes, not by waiting for each.
 //
 
 #include "types.h"
@@ -17,11 +27,12 @@
 #include "fs.h"
 #include "buf.h"
 #include "virtio.h"
+#include "iostat.h"
 
-// the address of virtio mmio register r.
-#define R(r) ((volatile uint32 *)(VIRTIO0 + (r)))
+// the address of virtio mmio register r of disk d.
+#define R(d, r) ((volatile uint32 *)((d)->base + (r)))
 
-static struct disk
+struct disk
 {
     // memory for virtio descriptors &c for queue 0.
     // this is a global instead of allocated because it must
@@ -33,43 +44,67 @@ static struct disk
     struct UsedArea *used;
 
     // our own book-keeping.
-    char free[NUM];  // is a descriptor free?
-    uint16 used_idx; // we've looked this far in used[2..NUM].
+    char free[NUM];      // is a descriptor free?
+    uint16 freestk[NUM]; // indices of the free descriptors
+    int nfree;           // how many of freestk[] are in use
+    uint16 used_idx;     // we've looked this far in used[2..NUM].
+
+    // submitters sleeping for descriptors, and the fewest any of
+    // them needs: no point waking them for less.
+    int nwait;
+    int want;
+    uint64 stalls; // submissions that found too few free descriptors
+
+    int flush;      // VIRTIO_BLK_F_FLUSH: has a write cache to flush
+    uint64 flushes; // flush requests sent
 
     // track info about in-flight operations,
     // for use when completion interrupt arrives.
     // indexed by first descriptor index of chain.
     struct
     {
-        struct buf *b;
+        struct bioreq *r;
         char status;
     } info[NUM];
 
+    // disk command headers.
+    // one-for-one with descriptors, for convenience.
+    struct virtio_blk_outhdr ops[NUM];
+
     struct spinlock vdisk_lock;
 
-} __attribute__((aligned(PGSIZE))) disk;
+    uint64 base; // mmio registers
+} __attribute__((aligned(PGSIZE)));
 
-void virtio_disk_init(void)
+static struct disk disk[NDISK];
+
+// protects the pending counts of requests, which may have runs
+// on more than one disk.
+static struct spinlock reqlock;
+
+static void virtio_disk_init1(struct disk *d, uint64 base)
 {
     uint32 status = 0;
 
-    initlock(&disk.vdisk_lock, "virtio_disk");
+    initlock(&d->vdisk_lock, "virtio_disk");
+    d->base = base;
 
-    if (*R(VIRTIO_MMIO_MAGIC_VALUE) != 0x74726976 ||
-        *R(VIRTIO_MMIO_VERSION) != 1 || *R(VIRTIO_MMIO_DEVICE_ID) != 2 ||
-        *R(VIRTIO_MMIO_VENDOR_ID) != 0x554d4551)
+    if (*R(d, VIRTIO_MMIO_MAGIC_VALUE) != 0x74726976 ||
+        *R(d, VIRTIO_MMIO_VERSION) != 1 ||
+        *R(d, VIRTIO_MMIO_DEVICE_ID) != 2 ||
+        *R(d, VIRTIO_MMIO_VENDOR_ID) != 0x554d4551)
     {
         panic("could not find virtio disk");
     }
 
     status |= VIRTIO_CONFIG_S_ACKNOWLEDGE;
-    *R(VIRTIO_MMIO_STATUS) = status;
+    *R(d, VIRTIO_MMIO_STATUS) = status;
 
     status |= VIRTIO_CONFIG_S_DRIVER;
-    *R(VIRTIO_MMIO_STATUS) = status;
+    *R(d, VIRTIO_MMIO_STATUS) = status;
 
     // negotiate features
-    uint64 features = *R(VIRTIO_MMIO_DEVICE_FEATURES);
+    uint64 features = *R(d, VIRTIO_MMIO_DEVICE_FEATURES);
     features &= ~(1 << VIRTIO_BLK_F_RO);
     features &= ~(1 << VIRTIO_BLK_F_SCSI);
     features &= ~(1 << VIRTIO_BLK_F_CONFIG_WCE);
@@ -77,201 +112,348 @@ void virtio_disk_init(void)
     features &= ~(1 << VIRTIO_F_ANY_LAYOUT);
     features &= ~(1 << VIRTIO_RING_F_EVENT_IDX);
     features &= ~(1 << VIRTIO_RING_F_INDIRECT_DESC);
-    *R(VIRTIO_MMIO_DRIVER_FEATURES) = features;
+    *R(d, VIRTIO_MMIO_DRIVER_FEATURES) = features;
+    d->flush = (features & (1 << VIRTIO_BLK_F_FLUSH)) != 0;
 
     // tell device that feature negotiation is complete.
     status |= VIRTIO_CONFIG_S_FEATURES_OK;
-    *R(VIRTIO_MMIO_STATUS) = status;
+    *R(d, VIRTIO_MMIO_STATUS) = status;
 
     // tell device we're completely ready.
     status |= VIRTIO_CONFIG_S_DRIVER_OK;
-    *R(VIRTIO_MMIO_STATUS) = status;
+    *R(d, VIRTIO_MMIO_STATUS) = status;
 
-    *R(VIRTIO_MMIO_GUEST_PAGE_SIZE) = PGSIZE;
+    *R(d, VIRTIO_MMIO_GUEST_PAGE_SIZE) = PGSIZE;
 
     // initialize queue 0.
-    *R(VIRTIO_MMIO_QUEUE_SEL) = 0;
-    uint32 max = *R(VIRTIO_MMIO_QUEUE_NUM_MAX);
+    *R(d, VIRTIO_MMIO_QUEUE_SEL) = 0;
+    uint32 max = *R(d, VIRTIO_MMIO_QUEUE_NUM_MAX);
     if (max == 0)
         panic("virtio disk has no queue 0");
     if (max < NUM)
         panic("virtio disk max queue too short");
-    *R(VIRTIO_MMIO_QUEUE_NUM) = NUM;
-    memset(disk.pages, 0, sizeof(disk.pages));
-    *R(VIRTIO_MMIO_QUEUE_PFN) = ((uint64)disk.pages) >> PGSHIFT;
+    *R(d, VIRTIO_MMIO_QUEUE_NUM) = NUM;
+    memset(d->pages, 0, sizeof(d->pages));
+    *R(d, VIRTIO_MMIO_QUEUE_PFN) = ((uint64)d->pages) >> PGSHIFT;
 
     // desc = pages -- num * VRingDesc
     // avail = pages + 0x40 -- 2 * uint16, then num * uint16
     // used = pages + 4096 -- 2 * uint16, then num * vRingUsedElem
 
-    disk.desc = (struct VRingDesc *)disk.pages;
-    disk.avail =
-        (uint16 *)(((char *)disk.desc) + NUM * sizeof(struct VRingDesc));
-    disk.used = (struct UsedArea *)(disk.pages + PGSIZE);
+    d->desc = (struct VRingDesc *)d->pages;
+    d->avail = (uint16 *)(((char *)d->desc) + NUM * sizeof(struct VRingDesc));
+    d->used = (struct UsedArea *)(d->pages + PGSIZE);
 
     for (int i = 0; i < NUM; i++)
-        disk.free[i] = 1;
+    {
+        d->free[i] = 1;
+        d->freestk[d->nfree++] = i;
+    }
 
-    // plic.c and trap.c arrange for interrupts from VIRTIO0_IRQ.
+    // plic.c and trap.c arrange for interrupts from its IRQ.
 }
 
-// find a free descriptor, mark it non-free, return its index.
-static int alloc_desc()
+void virtio_disk_init(void)
 {
-    for (int i = 0; i < NUM; i++)
-    {
-        if (disk.free[i])
-        {
-            disk.free[i] = 0;
-            return i;
-        }
-    }
-    return -1;
+    initlock(&reqlock, "virtio_req");
+    virtio_disk_init1(&disk[0], VIRTIO0);
+    virtio_disk_init1(&disk[1], VIRTIO1);
+}
+
+// take a free descriptor, mark it non-free, return its index.
+static int alloc_desc(struct disk *d)
+{
+    int i;
+
+    if (d->nfree == 0)
+        return -1;
+    i = d->freestk[--d->nfree];
+    d->free[i] = 0;
+    return i;
 }
 
 // mark a descriptor as free.
-static void free_desc(int i)
+static void free_desc(struct disk *d, int i)
 {
     if (i >= NUM)
         panic("virtio_disk_intr 1");
-    if (disk.free[i])
+    if (d->free[i])
         panic("virtio_disk_intr 2");
-    disk.desc[i].addr = 0;
-    disk.free[i] = 1;
-    wakeup(&disk.free[0]);
+    d->desc[i].addr = 0;
+    d->free[i] = 1;
+    d->freestk[d->nfree++] = i;
 }
 
-// free a chain of descriptors.
-static void free_chain(int i)
+// free a chain of descriptors, and wake the submitters sleeping
+// for descriptors if one of them can now have all it needs.
+static void free_chain(struct disk *d, int i)
 {
     while (1)
     {
-        free_desc(i);
-        if (disk.desc[i].flags & VRING_DESC_F_NEXT)
-            i = disk.desc[i].next;
+        free_desc(d, i);
+        if (d->desc[i].flags & VRING_DESC_F_NEXT)
+            i = d->desc[i].next;
         else
             break;
     }
+    if (d->nwait > 0 && d->nfree >= d->want)
+    {
+        d->nwait = 0;
+        wakeup(&d->nwait);
+    }
 }
 
-static int alloc3_desc(int *idx)
+// allocate n descriptors, all or none.
+static int alloc_descs(struct disk *d, int *idx, int n)
 {
-    for (int i = 0; i < 3; i++)
-    {
-        idx[i] = alloc_desc();
-        if (idx[i] < 0)
-        {
-            for (int j = 0; j < i; j++)
-                free_desc(idx[j]);
-            return -1;
-        }
-    }
+    if (d->nfree < n)
+        return -1;
+    for (int i = 0; i < n; i++)
+        idx[i] = alloc_desc(d);
     return 0;
 }
 
-void virtio_disk_rw(struct buf *b, int write)
+// format the n+2 descriptors idx[0..n+1] of one of r's requests,
+// to move r's buffers to or from consecutive blocks of disk d
+// starting at blockno, or to flush d's write cache (n is 0), and
+// make the request available to the device. the caller notifies
+// the device.
+static void queue_req(struct disk *d, int *idx, struct bioreq *r,
+                      uint blockno)
 {
-    uint64 sector = b->blockno * (BSIZE / 512);
-
-    acquire(&disk.vdisk_lock);
+    // the spec says that legacy block operations use a descriptor
+    // for type/reserved/sector, then the data, then one for a
+    // 1-byte status result. the data may be split over several
+    // descriptors, which lets one request cover many buffers.
+    // qemu's virtio-blk.c reads them.
 
-    // the spec says that legacy block operations use three
-    // descriptors: one for type/reserved/sector, one for
-    // the data, one for a 1-byte status result.
+    struct virtio_blk_outhdr *buf0 = &d->ops[idx[0]];
+    int i, n = r->n;
 
-    // allocate the three descriptors.
-    int idx[3];
-    while (1)
-    {
-        if (alloc3_desc(idx) == 0)
-        {
-            break;
-        }
-        sleep(&disk.free[0], &disk.vdisk_lock);
-    }
+    if (r->flush)
+        buf0->type = VIRTIO_BLK_T_FLUSH; // no data, just the status
+    else if (r->write)
+        buf0->type = VIRTIO_BLK_T_OUT; // write the disk
+    else
+        buf0->type = VIRTIO_BLK_T_IN; // read the disk
+    buf0->reserved = 0;
+    buf0->sector = (uint64)blockno * (BSIZE / 512);
 
-    // format the three descriptors.
-    // qemu's virtio-blk.c reads them.
+    d->desc[idx[0]].addr = (uint64)buf0;
+    d->desc[idx[0]].len = sizeof(*buf0);
+    d->desc[idx[0]].flags = VRING_DESC_F_NEXT;
+    d->desc[idx[0]].next = idx[1];
 
-    struct virtio_blk_outhdr
+    for (i = 1; i <= n; i++)
     {
-        uint32 type;
-        uint32 reserved;
-        uint64 sector;
-    } buf0;
-
-    if (write)
-        buf0.type = VIRTIO_BLK_T_OUT; // write the disk
-    else
-        buf0.type = VIRTIO_BLK_T_IN; // read the disk
-    buf0.reserved = 0;
-    buf0.sector = sector;
-
-    // buf0 is on a kernel stack, which is not direct mapped,
-    // thus the call to kvmpa().
-    disk.desc[idx[0]].addr = (uint64)kvmpa((uint64)&buf0);
-    disk.desc[idx[0]].len = sizeof(buf0);
-    disk.desc[idx[0]].flags = VRING_DESC_F_NEXT;
-    disk.desc[idx[0]].next = idx[1];
-
-    disk.desc[idx[1]].addr = (uint64)b->data;
-    disk.desc[idx[1]].len = BSIZE;
-    if (write)
-        disk.desc[idx[1]].flags = 0; // device reads b->data
-    else
-        disk.desc[idx[1]].flags = VRING_DESC_F_WRITE; // device writes b->data
-    disk.desc[idx[1]].flags |= VRING_DESC_F_NEXT;
-    disk.desc[idx[1]].next = idx[2];
+        d->desc[idx[i]].addr = (uint64)r->bp[i - 1]->data;
+        d->desc[idx[i]].len = BSIZE;
+        if (r->write)
+            d->desc[idx[i]].flags = 0; // device reads the data
+        else
+            d->desc[idx[i]].flags = VRING_DESC_F_WRITE; // device writes it
+        d->desc[idx[i]].flags |= VRING_DESC_F_NEXT;
+        d->desc[idx[i]].next = idx[i + 1];
+    }
 
-    disk.info[idx[0]].status = 0;
-    disk.desc[idx[2]].addr = (uint64)&disk.info[idx[0]].status;
-    disk.desc[idx[2]].len = 1;
-    disk.desc[idx[2]].flags = VRING_DESC_F_WRITE; // device writes the status
-    disk.desc[idx[2]].next = 0;
+    d->info[idx[0]].status = 0;
+    d->desc[idx[n + 1]].addr = (uint64)&d->info[idx[0]].status;
+    d->desc[idx[n + 1]].len = 1;
+    d->desc[idx[n + 1]].flags = VRING_DESC_F_WRITE; // device writes status
+    d->desc[idx[n + 1]].next = 0;
 
-    // record struct buf for virtio_disk_intr().
-    b->disk = 1;
-    disk.info[idx[0]].b = b;
+    // record the request for virtio_disk_intr().
+    d->info[idx[0]].r = r;
 
     // avail[0] is flags
     // avail[1] tells the device how far to look in avail[2...].
     // avail[2...] are desc[] indices the device should process.
     // we only tell device the first index in our chain of descriptors.
-    disk.avail[2 + (disk.avail[1] % NUM)] = idx[0];
+    d->avail[2 + (d->avail[1] % NUM)] = idx[0];
     __sync_synchronize();
-    disk.avail[1] = disk.avail[1] + 1;
+    d->avail[1] = d->avail[1] + 1;
+}
+
+// Start r, and return without waiting for it to finish: r->bp[0..n-1]
+// move to or from each of r->nleg runs of consecutive blocks, run i
+// starting at block r->blockno[i] of disk r->disk[i], one device
+// request per run. If the descriptors are not free, sleep until they
+// are, or return -1, having started nothing, if nowait is set; only
+// a one-run request may set it. A flush request has no buffers and
+// a run per disk to flush. When r finishes, virtio_disk_intr()
+// calls r->done(r), if set, and wakes anyone in virtio_disk_wait().
+// r belongs to the driver until then.
+int virtio_disk_submit(struct bioreq *r, int nowait)
+{
+    struct disk *d;
+    int idx[NUM];
+    int i, j, len = r->n + 2;
+
+    if ((r->flush ? r->n != 0 : r->n < 1) || r->n > NBATCH ||
+        r->nleg < 1 || r->nleg > 2 ||
+        len > NUM || (nowait && r->nleg != 1))
+        panic("virtio_disk_submit");
+
+    r->pending = r->nleg;
+    for (i = 0; i < r->n; i++)
+        r->bp[i]->disk = 1;
+
+    // each run is queued and notified on its own disk before the
+    // next is started, so holding its descriptors while we sleep
+    // for the next disk's cannot deadlock.
+    for (i = 0; i < r->nleg; i++)
+    {
+        if (r->disk[i] < 0 || r->disk[i] >= NDISK)
+            panic("virtio_disk_submit disk");
+        d = &disk[r->disk[i]];
+        acquire(&d->vdisk_lock);
+        if (alloc_descs(d, idx, len) != 0)
+        {
+            d->stalls++;
+            if (nowait)
+            {
+                release(&d->vdisk_lock);
+                r->pending = 0;
+                for (j = 0; j < r->n; j++)
+                    r->bp[j]->disk = 0;
+                return -1;
+            }
+            do
+            {
+                // woken ones that still don't fit sleep again, so
+                // each round of sleepers sets want afresh.
+                if (d->nwait == 0 || len < d->want)
+                    d->want = len;
+                d->nwait++;
+                sleep(&d->nwait, &d->vdisk_lock);
+            } while (alloc_descs(d, idx, len) != 0);
+        }
+        if (r->flush)
+            d->flushes++;
+        queue_req(d, idx, r, r->blockno[i]);
+        *R(d, VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+        release(&d->vdisk_lock);
+    }
+    return 0;
+}
+
+// Wait until each of the n requests rs[0..n-1] has finished.
+void virtio_disk_wait(struct bioreq **rs, int n)
+{
+    int i;
+
+    acquire(&reqlock);
+    for (i = 0; i < n; i++)
+    {
+        while (rs[i]->pending > 0)
+        {
+            sleep(rs[i], &reqlock);
+        }
+    }
+    release(&reqlock);
+}
 
-    *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+// Read or write the n buffers bp[0..n-1], which hold consecutive
+// blocks, at each of the nleg runs of blocks starting at block
+// blockno[i] of disk dsk[i], and wait for all of it to finish.
+// Used to move a run of blocks on both RAID-1 legs in parallel.
+void virtio_disk_rwn(struct buf **bp, int n, int *dsk, uint *blockno,
+                     int nleg, int write)
+{
+    struct bioreq r, *rp = &r;
+    int i;
 
-    // Wait for virtio_disk_intr() to say request has finished.
-    while (b->disk == 1)
+    if (n < 1 || n > NBATCH || nleg < 1 || nleg > 2)
+        panic("virtio_disk_rwn");
+
+    memset(&r, 0, sizeof(r));
+    for (i = 0; i < n; i++)
+        r.bp[i] = bp[i];
+    r.n = n;
+    for (i = 0; i < nleg; i++)
     {
-        sleep(b, &disk.vdisk_lock);
+        r.disk[i] = dsk[i];
+        r.blockno[i] = blockno[i];
     }
+    r.nleg = nleg;
+    r.write = write;
+
+    virtio_disk_submit(&r, 0);
+    virtio_disk_wait(&rp, 1);
+}
+
+// Flush the write caches of the nleg disks dsk[0..nleg-1] in
+// parallel, and wait: every write that had finished is then on
+// stable storage. Disks without a write cache need nothing.
+void virtio_disk_flush(int *dsk, int nleg)
+{
+    struct bioreq r, *rp = &r;
+    int i;
+
+    memset(&r, 0, sizeof(r));
+    r.flush = 1;
+    for (i = 0; i < nleg; i++)
+        if (disk[dsk[i]].flush)
+            r.disk[r.nleg++] = dsk[i];
+    if (r.nleg == 0)
+        return;
+    virtio_disk_submit(&r, 0);
+    virtio_disk_wait(&rp, 1);
+}
 
-    disk.info[idx[0]].b = 0;
-    free_chain(idx[0]);
+// Add the driver's counters to *st.
+void virtio_disk_stat(struct iostat *st)
+{
+    struct disk *d;
 
-    release(&disk.vdisk_lock);
+    for (d = disk; d < disk + NDISK; d++)
+    {
+        acquire(&d->vdisk_lock);
+        st->vqstalls += d->stalls;
+        st->vflushes += d->flushes;
+        release(&d->vdisk_lock);
+    }
 }
 
-void virtio_disk_intr()
+// Handle an interrupt from disk n.
+void virtio_disk_intr(int n)
 {
-    acquire(&disk.vdisk_lock);
+    struct disk *d = &disk[n];
+    struct bioreq *r;
+    int i;
 
-    while ((disk.used_idx % NUM) != (disk.used->id % NUM))
+    acquire(&d->vdisk_lock);
+
+    while ((d->used_idx % NUM) != (d->used->id % NUM))
     {
-        int id = disk.used->elems[disk.used_idx].id;
+        int id = d->used->elems[d->used_idx].id;
 
-        if (disk.info[id].status != 0)
+        if (d->info[id].status != 0)
             panic("virtio_disk_intr status");
 
-        disk.info[id].b->disk = 0; // disk is done with buf
-        wakeup(disk.info[id].b);
+        // the submitter may be waiting, or may have moved on: either
+        // way the chain is ours to free.
+        r = d->info[id].r;
+        d->info[id].r = 0;
+        free_chain(d, id);
+
+        // disk is done with the bufs once all r's requests are,
+        // on this disk and any other.
+        acquire(&reqlock);
+        if (--r->pending == 0)
+        {
+            for (i = 0; i < r->n; i++)
+                r->bp[i]->disk = 0;
+            wakeup(r);
+            if (r->done)
+                r->done(r);
+        }
+        release(&reqlock);
 
-        disk.used_idx = (disk.used_idx + 1) % NUM;
+        d->used_idx = (d->used_idx + 1) % NUM;
     }
-    *R(VIRTIO_MMIO_INTERRUPT_ACK) = *R(VIRTIO_MMIO_INTERRUPT_STATUS) & 0x3;
+    *R(d, VIRTIO_MMIO_INTERRUPT_ACK) =
+        *R(d, VIRTIO_MMIO_INTERRUPT_STATUS) & 0x3;
 
-    release(&disk.vdisk_lock);
+    release(&d->vdisk_lock);
 }
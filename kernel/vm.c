@@ -28,6 +28,7 @@ void kvminit()
 
     // virtio mmio disk interface
     kvmmap(VIRTIO0, VIRTIO0, PGSIZE, PTE_R | PTE_W);
+    kvmmap(VIRTIO1, VIRTIO1, PGSIZE, PTE_R | PTE_W);
 
     // CLINT
     kvmmap(CLINT, CLINT, 0x10000, PTE_R | PTE_W);
@@ -24,12 +24,15 @@
 #define NINODES 200
 
 // Disk layout:
-// [ boot block | sb block | log | inode blocks | free bit map | data blocks ]
+// [ boot block | sb block | log | inode blocks | free bit map |
+//   write-intent bit maps | checksum table | data blocks ]
 
 int nbitmap = LOGICAL_DISK_SIZE / (BSIZE * 8) + 1;
+int nwib = 2 * WIBBLOCKS; // one map per RAID-1 leg, starting clear
+int ncsum = CSBLOCKS;
 int ninodeblocks = NINODES / IPB + 1;
-int nlog = LOGSIZE;
-int nmeta;   // Number of meta blocks (boot, sb, nlog, inode, bitmap)
+int nlog = 2 * (LOGSIZE + 1); // two regions: a header and LOGSIZE blocks
+int nmeta;   // Number of meta blocks (boot, sb, nlog, inode, bitmaps)
 int nblocks; // Number of data blocks
 
 int fsfd;
@@ -37,6 +40,8 @@ struct superblock sb;
 char zeroes[BSIZE];
 uint freeinode = 1;
 uint freeblock;
+uint csum[CSBLOCKS * CPB]; // checksums of what wsect() wrote
+int extents;               // -e: inodes map blocks by extents
 
 void balloc(int);
 void wsect(uint, void *);
@@ -45,6 +50,8 @@ void rinode(uint inum, struct dinode *ip);
 void rsect(uint sec, void *buf);
 uint ialloc(ushort type);
 void iappend(uint inum, void *p, int n);
+void crc32cinit(void);
+uint crc32c(uint crc, const void *p, int n);
 
 // convert to intel byte order
 ushort xshort(ushort x)
@@ -78,9 +85,15 @@ int main(int argc, char *argv[])
 
     static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
 
+    if (argc > 1 && strcmp(argv[1], "-e") == 0)
+    {
+        extents = 1;
+        argc--;
+        argv++;
+    }
     if (argc < 2)
     {
-        fprintf(stderr, "Usage: mkfs fs.img files...\n");
+        fprintf(stderr, "Usage: mkfs [-e] fs.img files...\n");
         exit(1);
     }
 
@@ -95,7 +108,7 @@ int main(int argc, char *argv[])
     }
 
     // 1 fs block = 1 disk sector
-    nmeta = 2 + nlog + ninodeblocks + nbitmap;
+    nmeta = 2 + nlog + ninodeblocks + nbitmap + nwib + ncsum;
     nblocks = LOGICAL_DISK_SIZE - nmeta;
 
     sb.magic = FSMAGIC;
@@ -106,14 +119,22 @@ int main(int argc, char *argv[])
     sb.logstart = xint(2);
     sb.inodestart = xint(2 + nlog);
     sb.bmapstart = xint(2 + nlog + ninodeblocks);
+    sb.wibstart = xint(2 + nlog + ninodeblocks + nbitmap);
+    sb.nwib = xint(nwib);
+    sb.csumstart = xint(2 + nlog + ninodeblocks + nbitmap + nwib);
+    sb.ncsum = xint(ncsum);
+    sb.features = xint(extents ? FS_EXTENTS : FS_BIGMAP);
 
     printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap "
-           "blocks %u) blocks %d total %d\n",
-           nmeta, nlog, ninodeblocks, nbitmap, nblocks, FSSIZE);
+           "blocks %u write-intent blocks %u checksum blocks %u) blocks %d "
+           "total %d\n",
+           nmeta, nlog, ninodeblocks, nbitmap, nwib, ncsum, nblocks, FSSIZE);
+
+    crc32cinit();
 
     freeblock = nmeta; // the first free block that we can allocate
 
-    for (i = 0; i < FSSIZE; i++)
+    for (i = 0; i < LOGICAL_DISK_SIZE; i++)
         wsect(i, zeroes);
 
     memset(buf, 0, sizeof(buf));
@@ -180,6 +201,10 @@ int main(int argc, char *argv[])
 
     balloc(freeblock);
 
+    // the table is written last, once every block is final.
+    for (i = 0; i < ncsum; i++)
+        wsect(xint(sb.csumstart) + i, (char *)csum + i * BSIZE);
+
     exit(0);
 }
 
@@ -195,6 +220,8 @@ void wsect(uint sec, void *buf)
         perror("write");
         exit(1);
     }
+    if (sec < LOGICAL_DISK_SIZE)
+        csum[sec] = xint(crc32c(0, buf, BSIZE));
 }
 
 void winode(uint inum, struct dinode *ip)
@@ -254,28 +281,119 @@ uint ialloc(ushort type)
 void balloc(int used)
 {
     uchar buf[BSIZE];
-    int i;
+    int i, b;
 
     printf("balloc: first %d blocks have been allocated\n", used);
-    assert(used < BSIZE * 8);
-    bzero(buf, BSIZE);
-    for (i = 0; i < used; i++)
+    assert(used < nbitmap * BPB);
+    // a big file may fill more than the first bitmap block.
+    for (b = 0; b * BPB < used; b++)
     {
-        buf[i / 8] = buf[i / 8] | (0x1 << (i % 8));
+        bzero(buf, BSIZE);
+        for (i = 0; i < BPB && b * BPB + i < used; i++)
+        {
+            buf[i / 8] = buf[i / 8] | (0x1 << (i % 8));
+        }
+        printf("balloc: write bitmap block at sector %d\n", sb.bmapstart + b);
+        wsect(sb.bmapstart + b, buf);
     }
-    printf("balloc: write bitmap block at sector %d\n", sb.bmapstart);
-    wsect(sb.bmapstart, buf);
 }
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
+// The disk block of file block fbn of indirect inode din, allocating
+// it, and the indirect blocks above it, if need be.
+uint imap(struct dinode *din, uint fbn)
+{
+    uint indirect[NINDIRECT], *slot, span, top = 0;
+    int level;
+
+    assert(fbn < MAXFILE);
+    if (fbn < NDIRECT)
+    {
+        if (xint(din->addrs[fbn]) == 0)
+            din->addrs[fbn] = xint(freeblock++);
+        return xint(din->addrs[fbn]);
+    }
+    fbn -= NDIRECT;
+    for (level = 1, span = NINDIRECT; fbn >= span; level++, span *= NINDIRECT)
+        fbn -= span;
+
+    // top is the indirect block slot is in, 0 for the inode.
+    slot = &din->addrs[NDIRECT + level - 1];
+    for (;;)
+    {
+        if (xint(*slot) == 0)
+        {
+            *slot = xint(freeblock++);
+            if (top)
+                wsect(top, (char *)indirect);
+        }
+        if (level == 0)
+            return xint(*slot);
+        top = xint(*slot);
+        rsect(top, (char *)indirect);
+        span /= NINDIRECT;
+        slot = &indirect[fbn / span];
+        fbn %= span;
+        level--;
+    }
+}
+
+// The disk block of file block fbn of extent inode din, allocating
+// it if fbn is just past the end: blocks are handed out in order,
+// so it usually extends the last extent.
+uint emap(struct dinode *din, uint fbn)
+{
+    struct extent *ie = (struct extent *)din->addrs, xe[NXEXTENT], *e = 0;
+    uint base = 0, x;
+    int i;
+
+    for (i = 0; i < MAXEXTENT; i++)
+    {
+        if (i == NIEXTENT)
+        {
+            if (xint(din->addrs[XADDR]) == 0)
+                break;
+            rsect(xint(din->addrs[XADDR]), (char *)xe);
+        }
+        e = i < NIEXTENT ? &ie[i] : &xe[i - NIEXTENT];
+        if (xint(e->len) == 0)
+            break;
+        if (fbn < base + xint(e->len))
+            return xint(e->start) + fbn - base;
+        base += xint(e->len);
+    }
+    assert(fbn == base && i < MAXEXTENT);
+
+    x = freeblock++;
+    if (i > 0)
+        e = i - 1 < NIEXTENT ? &ie[i - 1] : &xe[i - 1 - NIEXTENT];
+    if (i > 0 && xint(e->start) + xint(e->len) == x)
+    {
+        e->len = xint(xint(e->len) + 1);
+    }
+    else
+    {
+        if (i == NIEXTENT && xint(din->addrs[XADDR]) == 0)
+        {
+            din->addrs[XADDR] = xint(freeblock++);
+            bzero(xe, sizeof(xe));
+        }
+        e = i < NIEXTENT ? &ie[i] : &xe[i - NIEXTENT];
+        e->start = xint(x);
+        e->len = xint(1);
+    }
+    if (xint(din->addrs[XADDR]) != 0)
+        wsect(xint(din->addrs[XADDR]), (char *)xe);
+    return x;
+}
+
 void iappend(uint inum, void *xp, int n)
 {
     char *p = (char *)xp;
     uint fbn, off, n1;
     struct dinode din;
     char buf[BSIZE];
-    uint indirect[NINDIRECT];
     uint x;
 
     rinode(inum, &din);
@@ -284,28 +402,13 @@ void iappend(uint inum, void *xp, int n)
     while (n > 0)
     {
         fbn = off / BSIZE;
-        assert(fbn < MAXFILE);
-        if (fbn < NDIRECT)
+        if (extents)
         {
-            if (xint(din.addrs[fbn]) == 0)
-            {
-                din.addrs[fbn] = xint(freeblock++);
-            }
-            x = xint(din.addrs[fbn]);
+            x = emap(&din, fbn);
         }
         else
         {
-            if (xint(din.addrs[NDIRECT]) == 0)
-            {
-                din.addrs[NDIRECT] = xint(freeblock++);
-            }
-            rsect(xint(din.addrs[NDIRECT]), (char *)indirect);
-            if (indirect[fbn - NDIRECT] == 0)
-            {
-                indirect[fbn - NDIRECT] = xint(freeblock++);
-                wsect(xint(din.addrs[NDIRECT]), (char *)indirect);
-            }
-            x = xint(indirect[fbn - NDIRECT]);
+            x = imap(&din, fbn);
         }
         n1 = min(n, (fbn + 1) * BSIZE - off);
         rsect(x, buf);
@@ -0,0 +1,99 @@
+// Buffer cache contention benchmark.
+//
+// Forks nproc readers that each re-read a small file of their own.
+// The files stay resident in the buffer cache, so after the first
+// pass every block read is a cache hit, and the run measures how
+// many hits per tick the cache sustains. Compare runs booted with
+// different `make CPUS=n qemu` to see hits scale with the harts.
+// Given a disk, runs with that RAID-1 leg's failure simulated, which
+// should cost nothing once the files are cached.
+//
+// Usage: bcachebench [nproc] [rounds] [failed disk]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fs.h"
+#include "kernel/fcntl.h"
+#include "kernel/iostat.h"
+#include "user/user.h"
+
+#define NBLK 4 // blocks per file
+#define MAXPROC 8
+
+char buf[BSIZE];
+
+int main(int argc, char *argv[])
+{
+    int nproc = 3, rounds = 300, failed = -1;
+    int i, r, fd, t0, t1;
+    char path[] = "bcbench0";
+    struct iostat st0, st1;
+
+    if (argc > 1)
+        nproc = atoi(argv[1]);
+    if (argc > 2)
+        rounds = atoi(argv[2]);
+    if (argc > 3)
+        failed = atoi(argv[3]);
+    if (nproc < 1 || nproc > MAXPROC || rounds < 1 || failed < -1 ||
+        failed > 1)
+    {
+        fprintf(2, "Usage: bcachebench [nproc 1-%d] [rounds] [failed disk]\n",
+                MAXPROC);
+        exit(1);
+    }
+
+    memset(buf, 'b', sizeof(buf));
+    for (i = 0; i < nproc; i++)
+    {
+        path[7] = '0' + i;
+        if ((fd = open(path, O_CREATE | O_RDWR)) < 0)
+        {
+            fprintf(2, "bcachebench: cannot create %s\n", path);
+            exit(1);
+        }
+        for (r = 0; r < NBLK; r++)
+            write(fd, buf, sizeof(buf));
+        close(fd);
+    }
+
+    force_disk_fail(failed);
+    iostat(&st0);
+    t0 = uptime();
+    for (i = 0; i < nproc; i++)
+    {
+        path[7] = '0' + i;
+        if (fork() == 0)
+        {
+            for (r = 0; r < rounds; r++)
+            {
+                if ((fd = open(path, O_RDONLY)) < 0)
+                    exit(1);
+                while (read(fd, buf, sizeof(buf)) > 0)
+                    ;
+                close(fd);
+            }
+            exit(0);
+        }
+    }
+    for (i = 0; i < nproc; i++)
+        wait(0);
+    t1 = uptime();
+    iostat(&st1);
+    force_disk_fail(-1);
+
+    if (t1 == t0)
+        t1 = t0 + 1;
+    printf("bcachebench: %d procs x %d rounds, %d ticks\n", nproc, rounds,
+           t1 - t0);
+    printf("bcachebench: %d hits, %d misses, %d hits/tick\n",
+           (int)(st1.bhits - st0.bhits), (int)(st1.bmisses - st0.bmisses),
+           (int)(st1.bhits - st0.bhits) / (t1 - t0));
+
+    for (i = 0; i < nproc; i++)
+    {
+        path[7] = '0' + i;
+        unlink(path);
+    }
+    exit(0);
+}
@@ -0,0 +1,131 @@
+// Large file test: write a file past the single indirect block's
+// reach, into the double indirect one (and, on a file system made
+// big enough with make FSSIZE=..., the triple), then read it back
+// and check every block. Reports the buffer cache lookups per block
+// read: with the inode's bmap() cache, a sequential read costs about
+// one, not one more per level of indirect blocks.
+//
+// Then unlink the file and write it again. If truncating it gave
+// back every block, indirect ones included, the second copy lands
+// on the same disk blocks as the first.
+//
+// Usage: bigfile [nblk]
+
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "kernel/iostat.h"
+#include "user/user.h"
+
+#define BSIZE 1024
+#define NCHUNK 8 // blocks per write() and read()
+
+char buf[NCHUNK * BSIZE];
+int *lbn; // where the first copy's blocks went
+
+void fail(char *why, int i)
+{
+    printf("bigfile: %s at block %d\n", why, i);
+    printf("Big File Test: FAIL\n");
+    exit(1);
+}
+
+// Stamp or check each block of buf, the n blocks from bn on.
+void stamp(int bn, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+    {
+        memset(buf + i * BSIZE, 'a' + (bn + i) % 26, BSIZE);
+        memmove(buf + i * BSIZE, &bn, sizeof(bn));
+        bn++;
+    }
+}
+
+int check(int bn, int n)
+{
+    int i, got;
+
+    for (i = 0; i < n; i++, bn++)
+    {
+        memmove(&got, buf + i * BSIZE, sizeof(got));
+        if (got != bn || buf[i * BSIZE + BSIZE - 1] != 'a' + bn % 26)
+            return bn;
+    }
+    return -1;
+}
+
+// Write bigfile.dat, nblk blocks long, and leave it open.
+int mkbig(int nblk)
+{
+    int fd, bn, n;
+
+    fd = open("bigfile.dat", O_CREATE | O_RDWR | O_TRUNC);
+    if (fd < 0)
+        fail("cannot create", 0);
+    for (bn = 0; bn < nblk; bn += n)
+    {
+        n = nblk - bn < NCHUNK ? nblk - bn : NCHUNK;
+        stamp(bn, n);
+        if (write(fd, buf, n * BSIZE) != n * BSIZE)
+            fail("write failed", bn);
+    }
+    return fd;
+}
+
+int main(int argc, char *argv[])
+{
+    int nblk = 1000, fd, bn, n, bad;
+    struct iostat st0, st1;
+    uint64 lookups;
+
+    if (argc > 1)
+        nblk = atoi(argv[1]);
+    if (nblk < 1)
+    {
+        fprintf(2, "Usage: bigfile [nblk]\n");
+        exit(1);
+    }
+    if ((lbn = malloc(nblk * sizeof(int))) == 0)
+        fail("out of memory", 0);
+
+    // blocks freed by a transaction are only reused once it commits,
+    // so start, and below start again, with none waiting.
+    sync();
+    fd = mkbig(nblk);
+    for (bn = 0; bn < nblk; bn++)
+        if ((lbn[bn] = get_disk_lbn(fd, bn)) <= 0)
+            fail("get_disk_lbn failed", bn);
+    close(fd);
+
+    fd = open("bigfile.dat", O_RDONLY);
+    if (fd < 0)
+        fail("cannot reopen", 0);
+    iostat(&st0);
+    for (bn = 0; bn < nblk; bn += n)
+    {
+        n = nblk - bn < NCHUNK ? nblk - bn : NCHUNK;
+        if (read(fd, buf, n * BSIZE) != n * BSIZE)
+            fail("read failed", bn);
+        if ((bad = check(bn, n)) >= 0)
+            fail("wrong data", bad);
+    }
+    iostat(&st1);
+    close(fd);
+
+    lookups = st1.bhits + st1.bmisses - st0.bhits - st0.bmisses;
+    printf("bigfile: %d blocks, %d KB, %d cache lookups per 100 blocks read\n",
+           nblk, nblk, (int)(100 * lookups / nblk));
+
+    if (unlink("bigfile.dat") < 0)
+        fail("unlink failed", 0);
+    sync();
+    fd = mkbig(nblk);
+    for (bn = 0; bn < nblk; bn++)
+        if (get_disk_lbn(fd, bn) != lbn[bn])
+            fail("rewritten file moved", bn);
+    close(fd);
+    unlink("bigfile.dat");
+    printf("Big File Test: PASS\n");
+    exit(0);
+}
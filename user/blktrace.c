@@ -0,0 +1,105 @@
+// Drain the kernel's block trace and print it.
+// blktrace [-c] [-t]
+//   -c  discard pending events without printing them
+//   -t  prefix each event with its timestamp and CPU
+
+#include "kernel/types.h"
+#include "kernel/blktrace.h"
+#include "user/user.h"
+
+#define NEV 32
+
+static char *policies[] = {"rr", "lor", "local"};
+
+static void print_skip(struct blkevent *e)
+{
+    printf("BW_ACTION: SKIP_PBN%d (PBN %d) due to simulated ", e->arg[0],
+           e->pbn);
+    if (e->arg[1] == BT_WHY_BLOCKFAIL)
+        printf("PBN0 block failure.\n");
+    else
+        printf("Disk %d failure.\n", e->arg[0]);
+}
+
+static void print_read(struct blkevent *e)
+{
+    printf("BR_ACTION: READ_PBN%d (PBN %d) ", e->arg[0], e->pbn);
+    if (e->arg[1] == BT_WHY_DISKFAIL)
+        printf("due to simulated Disk %d failure.\n", !e->arg[0]);
+    else if (e->arg[1] == BT_WHY_BLOCKFAIL)
+        printf("due to simulated PBN0 block failure.\n");
+    else if (e->arg[1] == BT_WHY_STALE)
+        printf("due to stale PBN%d.\n", !e->arg[0]);
+    else if (e->arg[1] == BT_WHY_CSUM)
+        printf("due to checksum mismatch on PBN%d.\n", !e->arg[0]);
+    else if (e->arg[2] >= 0 && e->arg[2] < 3)
+        printf("by %s policy.\n", policies[e->arg[2]]);
+    else
+        printf("by policy %d.\n", e->arg[2]);
+}
+
+static void print_event(struct blkevent *e, int tflag)
+{
+    if (tflag)
+        printf("[%l cpu%d] ", e->time, e->cpu);
+
+    switch (e->type)
+    {
+    case BT_BWRITE:
+        printf("BW_DIAG: PBN0=%d, PBN1=%d, sim_disk_fail=%d, "
+               "sim_pbn0_block_fail=%d\n",
+               e->pbn, e->arg[0], e->arg[1], e->arg[2]);
+        break;
+    case BT_SKIP:
+        print_skip(e);
+        break;
+    case BT_WRITE:
+        printf("BW_ACTION: ATTEMPT_PBN%d (PBN %d).\n", e->arg[0], e->pbn);
+        break;
+    case BT_READ:
+        print_read(e);
+        break;
+    case BT_RESYNC:
+        printf("RS_ACTION: COPY_PBN%d (PBN %d) from PBN%d.\n", e->arg[0],
+               e->pbn, !e->arg[0]);
+        break;
+    default:
+        printf("blktrace: unknown event type %d\n", e->type);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    struct blkevent ev[NEV];
+    int i, n, tflag = 0;
+
+    for (i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-c") == 0)
+        {
+            if (blktrace(0, 0) < 0)
+            {
+                fprintf(2, "blktrace: failed\n");
+                exit(1);
+            }
+            exit(0);
+        }
+        else if (strcmp(argv[i], "-t") == 0)
+            tflag = 1;
+        else
+        {
+            fprintf(2, "Usage: blktrace [-c] [-t]\n");
+            exit(1);
+        }
+    }
+
+    while ((n = blktrace(ev, NEV)) > 0)
+        for (i = 0; i < n; i++)
+            print_event(&ev[i], tflag);
+    if (n < 0)
+    {
+        fprintf(2, "blktrace: failed\n");
+        exit(1);
+    }
+    exit(0);
+}
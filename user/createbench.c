@@ -0,0 +1,107 @@
+// Concurrent small-file create benchmark.
+//
+// Forks nproc creators that each make nfile small files in a
+// directory of their own, then syncs. Every create is a log
+// transaction's worth of inode, directory and bitmap updates, so
+// the run measures how well FS calls keep going while the log
+// daemon commits: creates per tick, and how often a call had to
+// wait for log space. With dosync 1, each creator fsync()s every
+// file before closing it, as a mail spool or database would; compare
+// the commits and ticks with the default, batched run.
+//
+// Usage: createbench [nproc] [nfile] [dosync]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/iostat.h"
+#include "user/user.h"
+
+#define MAXPROC 8
+
+char path[] = "cb0/f00";
+
+char *name(int p, int i)
+{
+    path[2] = '0' + p;
+    path[5] = '0' + i / 10;
+    path[6] = '0' + i % 10;
+    return path;
+}
+
+int main(int argc, char *argv[])
+{
+    int nproc = 4, nfile = 50, dosync = 0;
+    int p, i, fd, t0, t1;
+    struct iostat st0, st1;
+
+    if (argc > 1)
+        nproc = atoi(argv[1]);
+    if (argc > 2)
+        nfile = atoi(argv[2]);
+    if (argc > 3)
+        dosync = atoi(argv[3]);
+    if (nproc < 1 || nproc > MAXPROC || nfile < 1 || nfile > 100)
+    {
+        fprintf(2, "Usage: createbench [nproc 1-%d] [nfile 1-100] "
+                   "[dosync]\n",
+                MAXPROC);
+        exit(1);
+    }
+
+    for (p = 0; p < nproc; p++)
+    {
+        path[3] = 0;
+        name(p, 0);
+        if (mkdir(path) < 0)
+        {
+            fprintf(2, "createbench: cannot mkdir %s\n", path);
+            exit(1);
+        }
+        path[3] = '/';
+    }
+    sync();
+
+    iostat(&st0);
+    t0 = uptime();
+    for (p = 0; p < nproc; p++)
+    {
+        if (fork() == 0)
+        {
+            for (i = 0; i < nfile; i++)
+            {
+                if ((fd = open(name(p, i), O_CREATE | O_RDWR)) < 0)
+                    exit(1);
+                write(fd, "x", 1);
+                if (dosync && fsync(fd) < 0)
+                    exit(1);
+                close(fd);
+            }
+            exit(0);
+        }
+    }
+    for (p = 0; p < nproc; p++)
+        wait(0);
+    sync();
+    t1 = uptime();
+    iostat(&st1);
+
+    if (t1 == t0)
+        t1 = t0 + 1;
+    printf("createbench: %d procs x %d files%s, %d ticks, %d creates/tick\n",
+           nproc, nfile, dosync ? " (fsync)" : "", t1 - t0,
+           nproc * nfile / (t1 - t0));
+    printf("createbench: %d commits, %d blocks logged, %d log waits\n",
+           (int)(st1.lcommits - st0.lcommits),
+           (int)(st1.llogged - st0.llogged), (int)(st1.lwaits - st0.lwaits));
+
+    for (p = 0; p < nproc; p++)
+    {
+        for (i = 0; i < nfile; i++)
+            unlink(name(p, i));
+        path[3] = 0;
+        unlink(path);
+        path[3] = '/';
+    }
+    exit(0);
+}
@@ -0,0 +1,105 @@
+// Checksum test: corrupt one leg's copy of a file block behind the
+// file system's back, and check that reads still return the right
+// data, and that the resync daemon rewrites the bad copy.
+
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "kernel/iostat.h"
+#include "kernel/raid.h"
+#include "user/user.h"
+
+#define BSIZE 1024
+#define NTRY 4    // reads; round-robin sends one of the first two to leg 0
+#define NWAIT 50  // ticks to give the resync daemon
+
+char data[BSIZE], junk[BSIZE], buf[BSIZE];
+
+uint64 csumerr(void)
+{
+    struct iostat st;
+
+    memset(&st, 0, sizeof(st));
+    if (iostat(&st) < 0)
+    {
+        printf("csumtest: iostat failed\n");
+        exit(1);
+    }
+    return st.mcsumerr;
+}
+
+int main(void)
+{
+    int fd, pbn, i, old;
+    uint64 err0;
+
+    memset(data, 'C', BSIZE);
+    memset(junk, 'X', BSIZE);
+
+    fd = open("csumtest.dat", O_CREATE | O_RDWR | O_TRUNC);
+    if (fd < 0 || write(fd, data, BSIZE) != BSIZE)
+    {
+        printf("csumtest: cannot write csumtest.dat\n");
+        exit(1);
+    }
+    pbn = get_disk_lbn(fd, 0);
+    close(fd);
+    sync(); // the raw write below must land after the commit
+    if (pbn <= 0)
+    {
+        printf("csumtest: get_disk_lbn failed\n");
+        exit(1);
+    }
+
+    // a raw write reaches leg 0 only, and takes the block out of
+    // the cache, so that the reads below go to disk.
+    if (raw_write(pbn, junk) < 0)
+    {
+        printf("csumtest: raw_write failed\n");
+        exit(1);
+    }
+    printf("csumtest: corrupted PBN %d\n", pbn);
+
+    old = set_read_policy(RAID_READ_RR);
+    err0 = csumerr();
+    for (i = 0; i < NTRY && csumerr() == err0; i++)
+    {
+        raw_read(pbn, buf); // drops the cached copy again
+        fd = open("csumtest.dat", O_RDONLY);
+        if (fd < 0 || read(fd, buf, BSIZE) != BSIZE)
+        {
+            printf("csumtest: read failed\n");
+            exit(1);
+        }
+        close(fd);
+        if (memcmp(buf, data, BSIZE) != 0)
+        {
+            printf("csumtest: read returned the corrupted copy\n");
+            printf("Checksum Test: FAIL\n");
+            exit(1);
+        }
+    }
+    set_read_policy(old);
+    if (csumerr() == err0)
+    {
+        printf("csumtest: no read found the bad copy\n");
+        printf("Checksum Test: FAIL\n");
+        exit(1);
+    }
+
+    for (i = 0; i < NWAIT; i++)
+    {
+        raw_read(pbn, buf);
+        if (memcmp(buf, data, BSIZE) == 0)
+            break;
+        sleep(1);
+    }
+    if (i == NWAIT)
+    {
+        printf("csumtest: PBN %d was not repaired\n", pbn);
+        printf("Checksum Test: FAIL\n");
+        exit(1);
+    }
+    unlink("csumtest.dat");
+    printf("Checksum Test: PASS\n");
+    exit(0);
+}
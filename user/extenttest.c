@@ -0,0 +1,82 @@
+// Block map test: write a file block by block, overwrite some of it,
+// and check that the data reads back and that the blocks stay where
+// they were put. Prints how many runs of consecutive disk blocks the
+// file takes: with an extent file system (make FS_MAP=extent) a file
+// written on an idle disk should take few.
+
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define BSIZE 1024
+#define NBLK 200  // blocks in the file, well past the direct ones
+#define OVER 50   // first block overwritten
+#define NOVER 10  // and how many
+
+char buf[BSIZE];
+int lbn[NBLK];
+
+void fail(char *why, int i)
+{
+    printf("extenttest: %s at block %d\n", why, i);
+    printf("Extent Test: FAIL\n");
+    exit(1);
+}
+
+// the byte block i holds, in round r.
+int pattern(int i, int r) { return 'a' + (i + r) % 26; }
+
+int main(void)
+{
+    int fd, i, r, runs;
+
+    fd = open("extenttest.dat", O_CREATE | O_RDWR | O_TRUNC);
+    if (fd < 0)
+        fail("cannot create", 0);
+    for (i = 0; i < NBLK; i++)
+    {
+        memset(buf, pattern(i, 0), BSIZE);
+        if (write(fd, buf, BSIZE) != BSIZE)
+            fail("write failed", i);
+    }
+    for (i = 0, runs = 0; i < NBLK; i++)
+    {
+        if ((lbn[i] = get_disk_lbn(fd, i)) <= 0)
+            fail("get_disk_lbn failed", i);
+        if (i == 0 || lbn[i] != lbn[i - 1] + 1)
+            runs++;
+    }
+    close(fd);
+
+    fd = open("extenttest.dat", O_RDWR);
+    if (fd < 0)
+        fail("cannot reopen", 0);
+    for (i = 0; i < OVER; i++)
+        read(fd, buf, BSIZE);
+    for (i = OVER; i < OVER + NOVER; i++)
+    {
+        memset(buf, pattern(i, 1), BSIZE);
+        if (write(fd, buf, BSIZE) != BSIZE)
+            fail("overwrite failed", i);
+    }
+    for (i = 0; i < NBLK; i++)
+        if (get_disk_lbn(fd, i) != lbn[i])
+            fail("block moved", i);
+    close(fd);
+
+    fd = open("extenttest.dat", O_RDONLY);
+    for (i = 0; i < NBLK; i++)
+    {
+        r = i >= OVER && i < OVER + NOVER;
+        if (read(fd, buf, BSIZE) != BSIZE)
+            fail("read failed", i);
+        if (buf[0] != pattern(i, r) || buf[BSIZE - 1] != pattern(i, r))
+            fail("wrong data", i);
+    }
+    close(fd);
+
+    printf("extenttest: %d blocks in %d runs\n", NBLK, runs);
+    unlink("extenttest.dat");
+    printf("Extent Test: PASS\n");
+    exit(0);
+}
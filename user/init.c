@@ -10,6 +10,7 @@
 #include "kernel/fcntl.h"
 
 char *argv[] = {"sh", 0};
+char *resyncd_argv[] = {"resyncd", 0};
 
 int main(void)
 {
@@ -23,6 +24,15 @@ int main(void)
     dup(0); // stdout
     dup(0); // stderr
 
+    // the RAID-1 resync daemon runs for good; its exit, if it fails,
+    // is reaped below like any parentless process's.
+    if (fork() == 0)
+    {
+        exec("resyncd", resyncd_argv);
+        printf("init: exec resyncd failed\n");
+        exit(1);
+    }
+
     for (;;)
     {
         printf("init: starting sh\n");
@@ -0,0 +1,36 @@
+// Print the kernel's block I/O counters.
+
+#include "kernel/types.h"
+#include "kernel/iostat.h"
+#include "user/user.h"
+
+int main(int argc, char *argv[])
+{
+    struct iostat st;
+
+    if (iostat(&st) < 0)
+    {
+        fprintf(2, "iostat: failed\n");
+        exit(1);
+    }
+
+    printf("bcache   hits %d misses %d\n", (int)st.bhits, (int)st.bmisses);
+    printf("bcache   buffers %d grown %d shrunk %d\n", (int)st.bbufs,
+           (int)st.bgrown, (int)st.bshrunk);
+    printf("readahd  issued %d hits %d wasted %d\n", (int)st.raissued,
+           (int)st.rahits, (int)st.rawasted);
+    printf("log      commits %d blocks %d waits %d\n", (int)st.lcommits,
+           (int)st.llogged, (int)st.lwaits);
+    printf("ckpt     installed %d absorbed %d\n", (int)st.linstalled,
+           (int)st.labsorbed);
+    printf("mirror   leg0 reads %d leg1 reads %d\n", (int)st.mreads[0],
+           (int)st.mreads[1]);
+    printf("resync   stale %d copied %d\n", (int)st.mstale,
+           (int)st.mresynced);
+    printf("checksum bad copies %d no good copy %d\n", (int)st.mcsumerr,
+           (int)st.mcsumlost);
+    printf("virtio   ring-full stalls %d flushes %d\n",
+           (int)st.vqstalls, (int)st.vflushes);
+    printf("trace    lost %d\n", (int)st.tlost);
+    exit(0);
+}
@@ -4,8 +4,8 @@
 #include "kernel/fcntl.h"
 
 #define BSIZE 1024
-#define LOGICAL_DISK_SIZE 2048
-#define DISK1_START_BLOCK 2048
+#define LOGICAL_DISK_SIZE 4096
+#define DISK1_START_BLOCK 4096
 
 char initial_data[BSIZE];
 char pbn0_corrupted_data[BSIZE];
@@ -103,7 +103,7 @@ int main()
            file_lbn_to_test, disk_lbn, pbn0, pbn1);
     close(fd_write);
     printf("  Waiting for commit...\n");
-    sleep(100);
+    sync();
 
     printf("  Verifying initial mirror state (Criterion 1):\n");
     if (read_physical_block_wrapper(pbn0, raw_read_buf1, "Initial PBN0") != 0)
@@ -4,8 +4,8 @@
 #include "kernel/fcntl.h"
 
 #define BSIZE 1024
-#define LOGICAL_DISK_SIZE 2048
-#define DISK1_START_BLOCK 2048
+#define LOGICAL_DISK_SIZE 4096
+#define DISK1_START_BLOCK 4096
 #define NUM_TEST_BLOCKS 3
 
 char data_to_write[BSIZE];
@@ -76,6 +76,7 @@ int main()
         printf("    File LBN %d mapped to Disk LBN %d.\n", lbn, disk_lbns[lbn]);
     }
     close(fd_write);
+    sync();
     printf("Phase 1: Completed.\n\n");
 
     printf("--- Phase 2: Verifying write mirroring (Criterion 1) ---\n");
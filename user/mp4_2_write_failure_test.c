@@ -76,6 +76,7 @@ int main(int argc, char *argv[])
         exit(1);
     }
     close(fd);
+    sync(); // keep the setup out of the scenario's trace
     printf("TEST_DRIVER_INFO: File LBN %d is mapped to Disk LBN (PBN0) %d.\n",
            TEST_FILE_LBN, pbn0_for_test_lbn);
     printf("TEST_DRIVER: Phase 0 - Setup complete.\n\n");
@@ -96,6 +97,7 @@ int main(int argc, char *argv[])
         fprintf(2, "TEST_DRIVER_ERROR: Unknown scenario %d\n", scenario);
         exit(1);
     }
+    blktrace(0, 0); // trace only this scenario's writes
 
     printf("TEST_DRIVER: Issuing standard write to File LBN %d.\n",
            TEST_FILE_LBN);
@@ -120,8 +122,19 @@ int main(int argc, char *argv[])
     close(fd);
 
     printf("TEST_DRIVER: Test write issued. Calling sync().\n");
+    sync();
     force_disk_fail(-1);
     force_fail(-1);
+
+    // The kernel traces its write decisions rather than printing them.
+    char *trace_argv[] = {"blktrace", 0};
+    if (fork() == 0)
+    {
+        exec("blktrace", trace_argv);
+        printf("TEST_DRIVER_ERROR: Cannot exec blktrace.\n");
+        exit(1);
+    }
+    wait(0);
     printf("TEST_DRIVER: Scenario %d finished. Check kernel output.\n",
            scenario);
     exit(0);
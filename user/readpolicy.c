@@ -0,0 +1,34 @@
+// Select how the kernel spreads reads over the RAID-1 legs.
+
+#include "kernel/types.h"
+#include "kernel/raid.h"
+#include "user/user.h"
+
+char *names[RAID_NPOLICY] = {
+    [RAID_READ_RR] "rr",
+    [RAID_READ_LOR] "lor",
+    [RAID_READ_LOCAL] "local",
+};
+
+int main(int argc, char *argv[])
+{
+    int i, old;
+
+    if (argc != 2)
+    {
+        fprintf(2, "Usage: readpolicy rr|lor|local\n");
+        exit(1);
+    }
+
+    for (i = 0; i < RAID_NPOLICY; i++)
+        if (strcmp(argv[1], names[i]) == 0)
+            break;
+    if (i == RAID_NPOLICY || (old = set_read_policy(i)) < 0)
+    {
+        fprintf(2, "readpolicy: bad policy %s\n", argv[1]);
+        exit(1);
+    }
+
+    printf("read policy %s (was %s)\n", names[i], names[old]);
+    exit(0);
+}
@@ -0,0 +1,12 @@
+// RAID-1 resync daemon, started by init: copies blocks that missed
+// writes on a failed leg back to it once it works again.
+
+#include "kernel/types.h"
+#include "user/user.h"
+
+int main(void)
+{
+    resync();
+    fprintf(2, "resyncd: resync failed\n");
+    exit(1);
+}
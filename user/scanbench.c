@@ -0,0 +1,138 @@
+// Buffer cache scan resistance benchmark.
+//
+// Alternates a metadata-heavy pass, which opens, stats and reads
+// each of a few dozen small files in a directory, with a sequential
+// scan of a file as big as the buffer cache. A cache that lets the
+// scan push out the directory, inode and small file blocks misses
+// on all of them in every metadata pass; compare kernels built with
+// `make BCACHE_POLICY=clock` and the default 2q.
+//
+// The cache could otherwise grow to hold the whole disk, so the
+// benchmark limits it to its smallest size while it runs. If the
+// file system has no room for the scanned file, make FSSIZE=8192.
+//
+// Usage: scanbench [rounds]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fs.h"
+#include "kernel/fcntl.h"
+#include "kernel/iostat.h"
+#include "user/user.h"
+
+#define NFILE 24 // small files in the metadata pass
+
+char buf[BSIZE];
+char path[] = "sbench/f00";
+int oldmax; // the cache's size limit before we set ours
+
+void mkfile(char *name, int nblk)
+{
+    int fd, i;
+
+    if ((fd = open(name, O_CREATE | O_RDWR)) < 0)
+    {
+        fprintf(2, "scanbench: cannot create %s\n", name);
+        set_bcache_max(oldmax);
+        exit(1);
+    }
+    for (i = 0; i < nblk; i++)
+        if (write(fd, buf, sizeof(buf)) != sizeof(buf))
+        {
+            fprintf(2, "scanbench: write %s failed at block %d of %d\n",
+                    name, i, nblk);
+            set_bcache_max(oldmax);
+            exit(1);
+        }
+    close(fd);
+}
+
+char *name(int i)
+{
+    path[8] = '0' + i / 10;
+    path[9] = '0' + i % 10;
+    return path;
+}
+
+void metapass(void)
+{
+    struct stat st;
+    int i, fd;
+
+    for (i = 0; i < NFILE; i++)
+    {
+        if ((fd = open(name(i), O_RDONLY)) < 0)
+            exit(1);
+        fstat(fd, &st);
+        read(fd, buf, sizeof(buf));
+        close(fd);
+    }
+}
+
+void scan(void)
+{
+    int fd;
+
+    if ((fd = open("sbench.big", O_RDONLY)) < 0)
+        exit(1);
+    while (read(fd, buf, sizeof(buf)) > 0)
+        ;
+    close(fd);
+}
+
+int main(int argc, char *argv[])
+{
+    int rounds = 10, r, i, t0, t1, nscan;
+    uint64 mhits = 0, mmisses = 0;
+    struct iostat st0, st1, s0, s1;
+
+    if (argc > 1)
+        rounds = atoi(argv[1]);
+    if (rounds < 1)
+    {
+        fprintf(2, "Usage: scanbench [rounds]\n");
+        exit(1);
+    }
+
+    if ((oldmax = set_bcache_max(1)) < 0)
+    {
+        fprintf(2, "scanbench: set_bcache_max failed\n");
+        exit(1);
+    }
+    nscan = set_bcache_max(1); // the smallest limit there is
+
+    memset(buf, 's', sizeof(buf));
+    mkdir("sbench");
+    for (i = 0; i < NFILE; i++)
+        mkfile(name(i), 1);
+    mkfile("sbench.big", nscan);
+
+    iostat(&st0);
+    t0 = uptime();
+    for (r = 0; r < rounds; r++)
+    {
+        iostat(&s0);
+        metapass();
+        iostat(&s1);
+        mhits += s1.bhits - s0.bhits;
+        mmisses += s1.bmisses - s0.bmisses;
+        scan();
+    }
+    t1 = uptime();
+    iostat(&st1);
+
+    printf("scanbench: %d rounds of %d files + %d block scan, %d ticks\n",
+           rounds, NFILE, nscan, t1 - t0);
+    printf("scanbench: metadata passes %d hits %d misses (%d%% hits)\n",
+           (int)mhits, (int)mmisses,
+           (int)(100 * mhits / (mhits + mmisses + 1)));
+    printf("scanbench: total %d hits %d misses\n",
+           (int)(st1.bhits - st0.bhits), (int)(st1.bmisses - st0.bmisses));
+
+    for (i = 0; i < NFILE; i++)
+        unlink(name(i));
+    unlink("sbench");
+    unlink("sbench.big");
+    set_bcache_max(oldmax);
+    exit(0);
+}
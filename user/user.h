@@ -1,5 +1,7 @@
 struct stat;
 struct rtcdate;
+struct iostat;
+struct blkevent;
 
 // system calls
 int fork(void);
@@ -32,6 +34,13 @@ int raw_read(int pbn, char *buf);
 int get_disk_lbn(int fd, int file_lbn);
 int raw_write(int pbn, char *buf);
 int force_disk_fail(int disk_id);
+int set_read_policy(int policy);
+int iostat(struct iostat *);
+int blktrace(struct blkevent *, int);
+int resync(void);
+int sync(void);
+int fsync(int);
+int set_bcache_max(int);
 
 // ulib.c
 int stat(const char *, struct stat *);
@@ -43,6 +43,14 @@ entry("raw_read");
 entry("get_disk_lbn");
 entry("raw_write");
 entry("force_disk_fail");
+entry("set_read_policy");
 # TODO: Access Control
 entry("symlink");
 entry("chmod");
+
+entry("iostat");
+entry("blktrace");
+entry("resync");
+entry("sync");
+entry("fsync");
+entry("set_bcache_max");